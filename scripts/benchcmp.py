@@ -177,6 +177,9 @@ def main():
             new_d = run_bench(new, "depth", args.depth, new_ref)
             print(row("nodes", base_d["nodes"], new_d["nodes"]))
             print(row("nps", base_d["nps"], new_d["nps"], +1, noise=3.0))
+            # Builds before the field was added leave it out
+            if "qnodes" in base_d and "qnodes" in new_d:
+                print(row("qsearch nodes", base_d["qnodes"], new_d["qnodes"]))
             if base_d["nodes"] == new_d["nodes"]:
                 print("\n  Identical node counts: the search walks the same tree as before,")
                 print("  so any change above is pure speed.")
@@ -28,6 +28,9 @@
 // Tablebases stay off in both modes, so the numbers mean the same thing on a
 // machine without `tb/`.
 //
+// With the nodestime option set, TIME counts its slice in nodes at that rate,
+// which makes it as reproducible as DEPTH while still stopping on time.
+//
 // Treat the position list as frozen. Editing it makes new numbers incomparable
 // with every number recorded before the edit, which is the one thing the bench
 // exists to prevent. If it has to change, bump kBenchVersion so old and new
@@ -83,12 +86,14 @@ inline constexpr int kBenchCount = sizeof(kBenchPositions) / sizeof(kBenchPositi
 
 // Searches every bench position and returns the node total. The last line is
 // machine readable and is what the comparison scripts parse.
-inline uint64 RunBench(BenchMode mode = BENCH_TIME, int limit = 0, uint64 hashMB = DEFAULT_HASH_MB) {
+inline uint64 RunBench(BenchMode mode = BENCH_TIME, int limit = 0, uint64 hashMB = DEFAULT_HASH_MB,
+                       int64 nodesPerMs = 0) {
     if (limit <= 0) limit = (mode == BENCH_TIME) ? kBenchTimeMs : kBenchDepth;
 
     Search search(hashMB);
     Timer timer;
     uint64 nodes = 0;
+    uint64 qnodes = 0;
     int64 depthSum = 0;
 
     timer.Start();
@@ -100,6 +105,7 @@ inline uint64 RunBench(BenchMode mode = BENCH_TIME, int limit = 0, uint64 hashMB
         limits.silent = true;
         if (mode == BENCH_TIME) {
             limits.maxTimeMs = limit;
+            limits.nodesPerMs = nodesPerMs;
         } else {
             limits.maxDepth = limit;
         }
@@ -107,6 +113,7 @@ inline uint64 RunBench(BenchMode mode = BENCH_TIME, int limit = 0, uint64 hashMB
         search.LoadPosition(kBenchPositions[i]);
         SearchResult result = search.Go(limits);
         nodes += result.nodes;
+        qnodes += result.qnodes;
         depthSum += result.depth;
 
         sync_printf("%2i/%2i  depth %2i  score %6" PRId64 "  nodes %10" PRIu64 "  best %s\n", i + 1, kBenchCount,
@@ -120,18 +127,57 @@ inline uint64 RunBench(BenchMode mode = BENCH_TIME, int limit = 0, uint64 hashMB
     sync_printf("positions     : %i\n", kBenchCount);
     sync_printf("mode          : %s\n", mode == BENCH_TIME ? "time" : "depth");
     sync_printf("limit         : %i %s\n", limit, mode == BENCH_TIME ? "ms per position" : "plies");
+    if (mode == BENCH_TIME && nodesPerMs > 0) sync_printf("nodestime     : %" PRId64 " nodes per ms\n", nodesPerMs);
     sync_printf("hash          : %" PRIu64 " MB\n", hashMB);
     sync_printf("time          : %.0f ms\n", elapsed * 1000.0f);
+    sync_printf("qsearch nodes : %" PRIu64 " (%.1f%%)\n", qnodes, nodes ? 100.0 * qnodes / nodes : 0.0);
 
     // In depth mode the node count is exact and reproducible, so also emit it
     // in the "<nodes> nodes <nps> nps" form that engine tooling expects.
     if (mode == BENCH_DEPTH) sync_printf("%" PRIu64 " nodes %" PRIu64 " nps\n", nodes, nps);
 
-    sync_printf("bench: version=%i mode=%s limit=%i depth=%" PRId64 " nodes=%" PRIu64 " nps=%" PRIu64 "\n",
-                kBenchVersion, mode == BENCH_TIME ? "time" : "depth", limit, depthSum, nodes, nps);
+    sync_printf("bench: version=%i mode=%s limit=%i depth=%" PRId64 " nodes=%" PRIu64 " nps=%" PRIu64
+                " qnodes=%" PRIu64 "\n",
+                kBenchVersion, mode == BENCH_TIME ? "time" : "depth", limit, depthSum, nodes, nps, qnodes);
     return nodes;
 }
 
+// Parses and writes back the bench positions, rounds times over, and reports
+// how many of each a second. A cheap check on the FEN code that batch work
+// such as EPD suites and data generation leans on.
+inline void RunFenBench(int rounds = 0) {
+    if (rounds <= 0) rounds = 20000;
+
+    Position position;
+    Timer timer;
+    uint64 checksum = 0; // Keeps the work from being optimised away
+
+    timer.Start();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < kBenchCount; i++) {
+            position.SetPosition(kBenchPositions[i]);
+            checksum ^= position.m_Hash;
+        }
+    }
+    float parse = timer.End();
+
+    timer.Start();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < kBenchCount; i++) {
+            checksum += position.ToFen().size();
+        }
+    }
+    float write = timer.End();
+
+    const uint64 count = (uint64)rounds * kBenchCount;
+    sync_printf("fens          : %" PRIu64 "\n", count);
+    sync_printf("SetPosition   : %.0f ms, %" PRIu64 " per second\n", parse * 1000.0f,
+                (uint64)(count / std::max(parse, 0.001f)));
+    sync_printf("ToFen         : %.0f ms, %" PRIu64 " per second\n", write * 1000.0f,
+                (uint64)(count / std::max(write, 0.001f)));
+    sync_printf("checksum      : %016" PRIx64 "\n", checksum);
+}
+
 // Parses the `bench` argument list shared by the UCI command and the command
 // line: "bench", "bench <ms>", "bench time <ms>", "bench depth <plies>".
 inline void ParseBenchArgs(const std::string& first, const std::string& second, BenchMode& mode, int& limit) {
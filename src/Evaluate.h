@@ -121,10 +121,11 @@ static Score Pawns(const Position& board) {
     return score;
 }
 
-// Relative static evaluation
-static int64 Evaluate(const Position& board, PawnTable* table) {
+// Relative static evaluation, white is the side to move
+template<Color white>
+static int64 TEvaluate(const Position& board, PawnTable* table) {
     int64 bareKing = 0;
-    if (BareKingScore(board, bareKing)) return board.m_WhiteMove ? bareKing : -bareKing;
+    if (BareKingScore(board, bareKing)) return white ? bareKing : -bareKing;
 
     int64 middlegame = 0, endgame = 0, result = 0;
     Score score = { 0, 0 };
@@ -141,7 +142,7 @@ static int64 Evaluate(const Position& board, PawnTable* table) {
 
     int whiteAttack = 0, blackAttack = 0;
 
-    middlegame += board.m_WhiteMove ? TEMPO : -TEMPO;
+    middlegame += white ? TEMPO : -TEMPO;
 
     // Calculate material imbalance
     for (int i = PieceType::PAWN; i < PieceType::QUEEN; i++) {
@@ -358,5 +359,9 @@ static int64 Evaluate(const Position& board, PawnTable* table) {
 
     phase = (phase * 256) / 24;
     result += (middlegame * (256 - phase) + endgame * phase) / 256;
-    return board.m_WhiteMove ? result : -result;
+    return white ? result : -result;
+}
+
+static inline int64 Evaluate(const Position& board, PawnTable* table) {
+    return board.m_WhiteMove ? TEvaluate<WHITE>(board, table) : TEvaluate<BLACK>(board, table);
 }
@@ -210,6 +210,14 @@ namespace Lookup {
         return white ? lines[8 * 4 * 4 + 1] : lines[8 * 3 * 4 + 1];
     }
 
+    // The whole file, rank or diagonal both squares are on, 0 if they do not share one
+    static constexpr uint64 LineThrough(int a, int b) {
+        for (int i = 0; i < 4; i++) {
+            if (lines[a * 4 + i] & (1ull << b)) return lines[a * 4 + i];
+        }
+        return 0;
+    }
+
     // check mask after getting checked by slider [kingsq * 64 + enemysq]
     static constexpr std::array<uint64, 64 * 64> check_mask = {
         000000000000000000, 0x0000000000000002, 0x0000000000000006, 0x000000000000000e,
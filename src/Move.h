@@ -47,7 +47,7 @@ static inline constexpr ColoredPieceType GetColoredPiece(PieceType type) {
 
 using Move = uint32;
 
-static inline Move BuildMove(uint8 from, uint8 to, ColoredPieceType type) {
+static inline constexpr Move BuildMove(uint8 from, uint8 to, ColoredPieceType type) {
     return from | to << 6 | type << 12;
 }
 
@@ -59,6 +59,27 @@ static inline Move BuildMove(uint8 from, uint8 to, ColoredPieceType type, Colore
     return from | to << 6 | type << 12 | capture << 16 | flags << 20;
 }
 
+// PackedMove, what the transposition table and the PV keep:
+// from: 6 bits
+// to:   6 bits
+// MoveFlag: 4 bits, 0 for none, then 1 to 6 for EP, Castle, PN, PB, PR, PQ
+//
+// The piece and capture types are read off the board again, see Position::UnpackMove
+
+using PackedMove = ushort;
+
+static inline constexpr PackedMove PackMove(Move move) {
+    const uint32 flags = (move >> 20) & 0x3F;
+    return (move & 0xFFF) | (flags ? std::countr_zero(flags) + 1 : 0) << 12;
+}
+
+// Without the pieces this is still enough to print the move
+static inline constexpr Move UnpackMove(PackedMove packed, ColoredPieceType type = NOPIECE,
+                                        ColoredPieceType capture = NOPIECE) {
+    const int flag = packed >> 12;
+    return (packed & 0xFFF) | type << 12 | capture << 16 | (flag ? 1u << (flag + 19) : 0);
+}
+
 static inline int From(Move move) {
     return (int)(move & 0x3F);
 }
@@ -1,33 +1,136 @@
 #include "MoveGen.h"
+#include <algorithm>
+#include <cstdlib>
 
 
-MoveGen::MoveGen(Position& position, Move hashmove, bool quiescence)
-    : m_Position(position), m_HashMove(hashmove), m_Current(&m_Moves[0]), m_End(&m_Moves[0]),
-      m_Stage(quiescence ? QUIESCENCE_TT : TT_MOVE) {}
+// No legal position comes near, but a FEN with a board full of queens can pass it. It is caught, see Close.
+// QQQQQQQQ/Q6Q/Q6Q/Q6Q/Q6Q/K6Q/BR5Q/kBQQQQQQ w - - 0 1
+static constexpr int MAX_MOVES = 256;
+
+// Room for two lists a ply, a singular search nests one at its own ply. Each list is followed by an empty move
+// that the stages stop at. The slack at the end lets an overlong last list be caught before it runs off the buffer.
+struct MoveArena {
+    ScoreMove m_Moves[(2 * MOVE_LIST_PLIES + 1) * (MAX_MOVES + 1)];
+    int m_Top = 0;
+};
+
+// Running out of room is a bug in the search or a position no game can reach. Either way the lists would be
+// written past the arena, so stop rather than corrupt memory.
+[[noreturn]] static void ArenaOverflow(const char* what) {
+    fprintf(stderr, "MoveGen: %s\n", what);
+    std::abort();
+}
+
+static thread_local MoveArena arena;
+
+MoveGen::MoveGen(Position& position, Move hashmove, bool quiescence, bool checks)
+    : m_Position(position), m_HashMove(hashmove), m_Begin(arena.m_Moves + arena.m_Top), m_Current(m_Begin),
+      m_End(m_Begin),
+      m_Stage(position.m_InCheck ? EVASION_TT
+              : quiescence       ? QUIESCENCE_TT
+                                 : TT_MOVE),
+      m_CapturesEnd(m_Begin), m_SortEnd(m_Begin), m_Checks(checks) {
+    if (arena.m_Top + (MAX_MOVES + 1) * 2 > (int)std::size(arena.m_Moves)) {
+        ArenaOverflow("move list arena is full, the search went deeper than MOVE_LIST_PLIES");
+    }
+    Close();
+}
+
+MoveGen::~MoveGen() {
+    arena.m_Top = m_Begin - arena.m_Moves;
+}
+
+// Ends the list with an empty move and keeps the lists nested in this one behind it
+void MoveGen::Close() {
+    if (m_End - m_Begin > MAX_MOVES) ArenaOverflow("more than MAX_MOVES moves in one position");
+    *m_End = ScoreMove{ 0, 0 };
+    arena.m_Top = m_End + 1 - arena.m_Moves;
+}
 
 static bool movecomp(const ScoreMove& a, const ScoreMove& b) {
     return a.score > b.score;
 }
 
-Move MoveGen::Next() {
+// Every capture, losing ones included, before the first quiet evasion. The same order the
+// staged generator would give.
+static bool evasioncomp(const ScoreMove& a, const ScoreMove& b) {
+    const bool aTactical = CaptureType(a.move) != NOPIECE || Promotion(a.move);
+    const bool bTactical = CaptureType(b.move) != NOPIECE || Promotion(b.move);
+    return aTactical != bTactical ? aTactical : a.score > b.score;
+}
+
+// Quiets scored at least this are put in order, the rest keep generation order. The castling bonus is well below.
+static constexpr int QUIET_SORT_LIMIT = 1000;
+
+// Sorts the moves scored at least limit to the front, best first. The rest are left unordered.
+static void PartialInsertionSort(ScoreMove* begin, ScoreMove* end, int limit) {
+    for (ScoreMove *sortedEnd = begin, *p = begin + 1; p < end; p++) {
+        if (p->score >= limit) {
+            ScoreMove tmp = *p, *q;
+            *p = *++sortedEnd;
+            for (q = sortedEnd; q != begin && (q - 1)->score < tmp.score; q--) *q = *(q - 1);
+            *q = tmp;
+        }
+    }
+}
+
+// Selection costs a pass per move handed out, past this many moves a sort up front is cheaper
+static constexpr int PICK_LIMIT = 16;
+
+// Most nodes cut off after a move or two, so rather than sorting the whole list up front only the next move is
+// selected. Ties stay in generation order, as they would in a short std::sort. A hash move found at the front is
+// skipped, it was already searched.
+template<typename Compare>
+void MoveGen::SortOrPick(ScoreMove* end, Compare comp) {
+    if (end - m_Current > PICK_LIMIT) {
+        std::sort(m_Current, end, comp);
+        m_SortEnd = m_Current;
+    } else {
+        m_SortEnd = end;
+    }
+}
+
+template<typename Compare>
+void MoveGen::PickNext(Compare comp) {
+    for (int i = 0; i < 2; i++) {
+        if (m_Current < m_SortEnd) {
+            ScoreMove* best = m_Current;
+            for (ScoreMove* it = m_Current + 1; it < m_SortEnd; it++) {
+                if (comp(*it, *best)) best = it;
+            }
+            ScoreMove tmp = *best;
+            std::move_backward(m_Current, best, best + 1);
+            *m_Current = tmp;
+        }
+        if (i || m_HashMove == 0 || m_Current->move != m_HashMove) return;
+        m_Current++;
+    }
+}
+
+template<Color white>
+Move MoveGen::TNext() {
     while (true) {
         switch (m_Stage) {
         case TT_MOVE:
         case QUIESCENCE_TT:
+        case EVASION_TT:
             m_Stage++;
-            // TODO: Check if hashmove is legal
-            if (m_HashMove != 0) return m_HashMove;
+            // Quiescence skips a quiet hash move, a quiet check is still generated in its own stage
+            if (m_Stage == QUIESCENCE_INIT && CaptureType(m_HashMove) == NOPIECE) m_HashMove = 0;
+            // A hash collision or a stale entry can hand us a move from another position
+            if (m_HashMove != 0 && m_Position.TIsPseudoLegal<white>(m_HashMove)
+                && m_Position.TIsLegal<white>(m_HashMove))
+                return m_HashMove;
+            m_HashMove = 0;
             break;
         case CAPTURE_INIT:
-            GenerateMoves<QUIESCENCE>();
-            // sort
-            if (m_Current != m_End) {
-                std::sort(m_Current, m_End - 1, movecomp);
-                m_CapturesEnd = m_End - 1;
-            }
+            TGenerateMoves<white, QUIESCENCE>();
+            Close();
+            m_CapturesEnd = m_End;
+            SortOrPick(m_End, movecomp);
             m_Stage++;
         case GOODCAPTURE_MOVE:
-            if (m_HashMove > 0 && m_Current->move == m_HashMove) m_Current++;
+            PickNext(movecomp);
             if (m_Current->score <= 0) {
                 m_BadCapture = m_Current;
                 m_Stage++;
@@ -37,15 +140,15 @@ Move MoveGen::Next() {
                 return (*(m_Current++)).move;
             }
             m_Stage++;
-        case QUIET_INIT:
-            GenerateMoves<SILENT>();
-            // sort
-            if (m_Current != m_End) {
-                //std::sort(m_Current, m_End - 1, movecomp);
-            }
+        case QUIET_INIT: {
+            ScoreMove* quiets = m_End;
+            TGenerateMoves<white, SILENT>();
+            Close();
+            PartialInsertionSort(quiets, m_End, QUIET_SORT_LIMIT);
             m_Stage++;
+        }
         case QUIET_MOVE:
-            if (m_HashMove > 0 && m_Current->move == m_HashMove) m_Current++;
+            PickNext(movecomp); // The bad captures left in front of the quiets
             if (m_Current != m_End) {
                 return (*(m_Current++)).move;
             }
@@ -57,20 +160,40 @@ Move MoveGen::Next() {
             }
             return 0; // Finished
         case QUIESCENCE_INIT:
-            //if (m_Position.m_InCheck) {
-            //  GenerateMoves<ALL>(); // Generates all evasions
-            //} else {
-            GenerateMoves<QUIESCENCE>();
-            // }
-            // sort
-            if (m_Current != m_End) std::sort(m_Current, m_End - 1, movecomp);
+            TGenerateMoves<white, QUIESCENCE>();
+            Close();
+            SortOrPick(m_End, movecomp);
             m_Stage++;
         case QUIESCENCE_MOVE:
-            if (m_HashMove > 0 && m_Current->move == m_HashMove) m_Current++;
+            PickNext(movecomp);
+            if (m_Current != m_End) {
+                return (*(m_Current++)).move;
+            }
+            if (!m_Checks) return 0; // Finished
+            m_Stage++;
+        case QUIET_CHECK_INIT:
+            TGenerateMoves<white, QUIET_CHECKS>();
+            Close();
+            m_Stage++;
+        case QUIET_CHECK_MOVE:
+            if (m_Current != m_End) {
+                return (*(m_Current++)).move;
+            }
+            return 0; // Finished
+        case EVASION_INIT:
+            TGenerateMoves<white, EVASIONS>();
+            Close();
+            SortOrPick(m_End, evasioncomp);
+            m_Stage++;
+        case EVASION_MOVE:
+            PickNext(evasioncomp);
             if (m_Current != m_End) {
                 return (*(m_Current++)).move;
             }
             return 0; // Finished
         }
     }
-}
\ No newline at end of file
+}
+
+template Move MoveGen::TNext<WHITE>();
+template Move MoveGen::TNext<BLACK>();
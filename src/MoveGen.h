@@ -2,7 +2,11 @@
 #include "Position.h"
 #include "Movelist.h"
 
-enum MoveGenType { ALL, QUIESCENCE, SILENT };
+#include <vector>
+
+// EVASIONS are every legal reply to a check, quiet or not. QUIET_CHECKS are the non capturing, non promoting moves
+// that give check.
+enum MoveGenType { ALL, QUIESCENCE, SILENT, EVASIONS, QUIET_CHECKS };
 
 template<Color white>
 static BitBoard TCheck(const Position& board, BitBoard& danger, BitBoard& active, BitBoard& rookPin,
@@ -513,8 +517,15 @@ enum MoveGenStage {
     BADCAPTURES_MOVE,
 
     QUIESCENCE_TT,
-    QUIESCENCE_INIT, // TODO: Generate evasions if in check
+    QUIESCENCE_INIT,
     QUIESCENCE_MOVE,
+    QUIET_CHECK_INIT, // Only when asked for, after the captures
+    QUIET_CHECK_MOVE,
+
+    // In check, in both search and quiescence
+    EVASION_TT,
+    EVASION_INIT,
+    EVASION_MOVE,
 };
 
 constexpr MoveGenStage operator++(MoveGenStage& cur, int) {
@@ -522,24 +533,42 @@ constexpr MoveGenStage operator++(MoveGenStage& cur, int) {
     return cur;
 }
 
+// Plies of move lists a thread has room for. The search stops deepening before it gets there.
+static constexpr int MOVE_LIST_PLIES = 64;
+
 // https://www.chessprogramming.org/Move_List#Search_Lists
+// The lists live in a buffer of the thread's own rather than in each MoveGen. A list starts right after the one of
+// the MoveGen it is nested in and gives the room back when it goes out of scope, so a search keeps working at the
+// front of the buffer. MoveGens have to be destroyed in the reverse order they were made, as locals are.
 class MoveGen {
 private:
     Position& m_Position;
     Move m_HashMove;
-    ScoreMove m_Moves[256] = {
-        0
-    }; // Will likely cause a crash on ludicrous positions with more than 256 moves QQQQQQQQ/Q6Q/Q6Q/Q6Q/Q6Q/K6Q/BR5Q/kBQQQQQQ w - - 0 1
+    ScoreMove* m_Begin;
     ScoreMove* m_Current;
     ScoreMove* m_End;
     MoveGenStage m_Stage;
     ScoreMove* m_CapturesEnd;
     ScoreMove* m_BadCapture;
+    ScoreMove* m_SortEnd; // Moves before it are still unordered, each is picked best first when needed
+    bool m_Checks;
 
 public:
-    MoveGen(Position& position, Move hashmove, bool quiescence);
+    // With checks quiescence also gets the quiet moves that give check
+    MoveGen(Position& position, Move hashmove, bool quiescence, bool checks = false);
+    ~MoveGen();
+
+    MoveGen(const MoveGen&) = delete;
+    MoveGen& operator=(const MoveGen&) = delete;
+
+    inline Move Next() { return m_Position.m_WhiteMove ? TNext<WHITE>() : TNext<BLACK>(); }
+
+    // The same for a side to move known at compile time, as in the search
+    template<Color white>
+    Move TNext();
 
-    Move Next();
+    // Whether the last move came from the quiet checks rather than the captures
+    inline bool QuietCheck() const { return m_Stage == QUIET_CHECK_MOVE; }
 
 private:
     inline int ScoreCapture(ColoredPieceType aggressor, ColoredPieceType victim) {
@@ -548,10 +577,12 @@ private:
 
     inline void pushMove(const ScoreMove& move) { *(m_End++) = move; }
 
-    template<MoveGenType T>
-    inline void GenerateMoves() {
-        m_Position.m_WhiteMove ? TGenerateMoves<WHITE, T>() : TGenerateMoves<BLACK, T>();
-    }
+    void Close();
+
+    template<typename Compare>
+    void SortOrPick(ScoreMove* end, Compare comp);
+    template<typename Compare>
+    void PickNext(Compare comp);
 
     template<Color white, MoveGenType T>
     void TGenerateMoves() {
@@ -561,6 +592,25 @@ private:
         BitBoard enPassantCheck = TCheck<white>(m_Position, danger, active, rookPin, bishopPin, enPassant);
         BitBoard moveable = ~Player<white>(m_Position) & active;
 
+        constexpr bool captures = T == QUIESCENCE || T == EVASIONS;
+        constexpr bool quiets = T == SILENT || T == EVASIONS || T == QUIET_CHECKS;
+
+        const BoardPos kingpos = GetSquare(King<white>(m_Position));
+        if constexpr (T == EVASIONS) {
+            if (!active) { // Double check, only the king can move
+                TGenerateKingMoves<white, T>(kingpos, danger);
+                return;
+            }
+        }
+
+        // A quiet check lands on a square attacking the enemy king, or steps off the line between it and our slider
+        const BoardPos enemyKing = GetSquare(King<enemy>(m_Position));
+        const CheckInfo* checkInfo = T == QUIET_CHECKS ? &m_Position.TGetCheckInfo<white>() : nullptr;
+        auto checking = [&](int pos, PieceType type) {
+            const BitBoard direct = checkInfo->m_Squares[type];
+            return (checkInfo->m_Blockers >> pos) & 1 ? direct | ~Lookup::LineThrough(enemyKing, pos) : direct;
+        };
+
         constexpr ColoredPieceType pawntype = GetColoredPiece<white>(PAWN);
         constexpr ColoredPieceType knighttype = GetColoredPiece<white>(KNIGHT);
         constexpr ColoredPieceType bishoptype = GetColoredPiece<white>(BISHOP);
@@ -576,7 +626,7 @@ private:
         BitBoard FPawns = PawnForward<white>(nonBishopPawn) & (~m_Position.m_Board)
                           & active; // No diagonally pinned pawn can move forward
 
-        if constexpr (T == SILENT) {
+        if constexpr (quiets) {
             BitBoard F2Pawns =
                 PawnForward<white>(nonBishopPawn & Lookup::StartingPawnRank<white>()) & ~m_Position.m_Board;
             F2Pawns =
@@ -588,6 +638,9 @@ private:
 
             while (F2Pawns > 0) { // Loop each bit
                 const BoardPos pos = PopPos(F2Pawns);
+                if constexpr (T == QUIET_CHECKS) {
+                    if (!(checking(PawnPos2Forward<enemy>(pos), PAWN) & (1ull << pos))) continue;
+                }
                 pushMove({ BuildMove(PawnPos2Forward<enemy>(pos), pos, pawntype), 0 });
             }
         }
@@ -616,7 +669,7 @@ private:
             RPawns = RPawns & ~FirstRank<enemy>();
             LPawns = LPawns & ~FirstRank<enemy>();
 
-            if constexpr (T == QUIESCENCE) {
+            if constexpr (captures) {
                 // Add Forward pawns
                 while (FPromote > 0) {
                     const BoardPos pos = PopPos(FPromote);
@@ -658,15 +711,18 @@ private:
             }
         }
 
-        if constexpr (T == SILENT) {
+        if constexpr (quiets) {
             while (FPawns > 0) {
                 const BoardPos pos = PopPos(FPawns);
+                if constexpr (T == QUIET_CHECKS) {
+                    if (!(checking(PawnPosForward<enemy>(pos), PAWN) & (1ull << pos))) continue;
+                }
                 pushMove({ BuildMove(PawnPosForward<enemy>(pos), pos, pawntype), 0 });
             }
         }
 
 
-        if constexpr (T == QUIESCENCE) {
+        if constexpr (captures) {
             while (RPawns > 0) { // Loop each bit
                 const BoardPos pos = PopPos(RPawns);
                 const ColoredPieceType capture = GetCaptureType<enemy>(m_Position, 1ull << pos);
@@ -711,7 +767,7 @@ private:
         while (knights > 0) { // Loop each bit
             int pos = PopPos(knights);
             BitBoard moves = Lookup::knight_attacks[pos] & moveable;
-            if constexpr (T == QUIESCENCE) {
+            if constexpr (captures) {
                 BitBoard qmove = moves & Enemy<white>(m_Position);
                 while (qmove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(qmove);
@@ -720,8 +776,9 @@ private:
                 }
             }
 
-            if constexpr (T == SILENT) {
+            if constexpr (quiets) {
                 BitBoard smove = moves & ~Enemy<white>(m_Position);
+                if constexpr (T == QUIET_CHECKS) smove &= checking(pos, KNIGHT);
                 while (smove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(smove);
                     pushMove({ BuildMove(pos, toPos, knighttype), 0 });
@@ -739,7 +796,7 @@ private:
         while (pinnedBishop > 0) {
             int pos = PopPos(pinnedBishop);
             BitBoard moves = m_Position.BishopAttack(pos, m_Position.m_Board) & moveable & bishopPin;
-            if constexpr (T == QUIESCENCE) {
+            if constexpr (captures) {
                 BitBoard qmove = moves & Enemy<white>(m_Position);
                 while (qmove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(qmove);
@@ -747,8 +804,9 @@ private:
                     pushMove({ BuildMove(pos, toPos, bishoptype, capture), ScoreCapture(bishoptype, capture) });
                 }
             }
-            if constexpr (T == SILENT) {
+            if constexpr (quiets) {
                 BitBoard smove = moves & ~Enemy<white>(m_Position);
+                if constexpr (T == QUIET_CHECKS) smove &= checking(pos, BISHOP);
                 while (smove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(smove);
                     pushMove({ BuildMove(pos, toPos, bishoptype), 0 });
@@ -761,7 +819,7 @@ private:
             BitBoard moves = m_Position.BishopAttack(pos, m_Position.m_Board) & moveable;
             BitBoard qmove = moves & Enemy<white>(m_Position);
             BitBoard smove = moves & ~Enemy<white>(m_Position);
-            if constexpr (T == QUIESCENCE) {
+            if constexpr (captures) {
                 while (qmove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(qmove);
                     const ColoredPieceType capture = GetCaptureType<enemy>(m_Position, 1ull << toPos);
@@ -769,7 +827,8 @@ private:
                 }
             }
 
-            if constexpr (T == SILENT) {
+            if constexpr (quiets) {
+                if constexpr (T == QUIET_CHECKS) smove &= checking(pos, BISHOP);
                 while (smove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(smove);
                     pushMove({ BuildMove(pos, toPos, bishoptype), 0 });
@@ -781,9 +840,7 @@ private:
         BitBoard rooks = Rook<white>(m_Position) & ~bishopPin; // A bishop pinned rook can not move
 
         // Castles
-        const BoardPos kingpos = GetSquare(King<white>(m_Position));
-
-        if constexpr (T == SILENT) {
+        if constexpr (T == SILENT) { // Never an evasion, the king may not castle out of check
             BitBoard CK = CastleKing<white>(m_Position.m_States[m_Position.m_Ply].m_CastleRights, danger,
                                             m_Position.m_Board, rooks);
             BitBoard CQ = CastleQueen<white>(m_Position.m_States[m_Position.m_Ply].m_CastleRights, danger,
@@ -804,7 +861,7 @@ private:
         while (pinnedRook > 0) {
             int pos = PopPos(pinnedRook);
             BitBoard moves = m_Position.RookAttack(pos, m_Position.m_Board) & moveable & rookPin;
-            if constexpr (T == QUIESCENCE) {
+            if constexpr (captures) {
                 BitBoard qmove = moves & Enemy<white>(m_Position);
                 while (qmove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(qmove);
@@ -813,8 +870,9 @@ private:
                 }
             }
 
-            if constexpr (T == SILENT) {
+            if constexpr (quiets) {
                 BitBoard smove = moves & ~Enemy<white>(m_Position);
+                if constexpr (T == QUIET_CHECKS) smove &= checking(pos, ROOK);
                 while (smove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(smove);
                     pushMove({ BuildMove(pos, toPos, rooktype), 0 });
@@ -825,7 +883,7 @@ private:
         while (notPinnedRook > 0) {
             int pos = PopPos(notPinnedRook);
             BitBoard moves = m_Position.RookAttack(pos, m_Position.m_Board) & moveable;
-            if constexpr (T == QUIESCENCE) {
+            if constexpr (captures) {
                 BitBoard qmove = moves & Enemy<white>(m_Position);
                 while (qmove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(qmove);
@@ -834,8 +892,9 @@ private:
                 }
             }
 
-            if constexpr (T == SILENT) {
+            if constexpr (quiets) {
                 BitBoard smove = moves & ~Enemy<white>(m_Position);
+                if constexpr (T == QUIET_CHECKS) smove &= checking(pos, ROOK);
                 while (smove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(smove);
                     pushMove({ BuildMove(pos, toPos, rooktype), 0 });
@@ -855,7 +914,7 @@ private:
         while (pinnedStraightQueen > 0) {
             int pos = PopPos(pinnedStraightQueen);
             BitBoard moves = m_Position.RookAttack(pos, m_Position.m_Board) & moveable & rookPin;
-            if constexpr (T == QUIESCENCE) {
+            if constexpr (captures) {
                 BitBoard qmove = moves & Enemy<white>(m_Position);
                 while (qmove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(qmove);
@@ -864,8 +923,9 @@ private:
                 }
             }
 
-            if constexpr (T == SILENT) {
+            if constexpr (quiets) {
                 BitBoard smove = moves & ~Enemy<white>(m_Position);
+                if constexpr (T == QUIET_CHECKS) smove &= checking(pos, QUEEN);
                 while (smove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(smove);
                     pushMove({ BuildMove(pos, toPos, queentype), 0 });
@@ -876,7 +936,7 @@ private:
         while (pinnedDiagonalQueen > 0) {
             int pos = PopPos(pinnedDiagonalQueen);
             BitBoard moves = m_Position.BishopAttack(pos, m_Position.m_Board) & moveable & bishopPin;
-            if constexpr (T == QUIESCENCE) {
+            if constexpr (captures) {
                 BitBoard qmove = moves & Enemy<white>(m_Position);
                 while (qmove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(qmove);
@@ -885,8 +945,9 @@ private:
                 }
             }
 
-            if constexpr (T == SILENT) {
+            if constexpr (quiets) {
                 BitBoard smove = moves & ~Enemy<white>(m_Position);
+                if constexpr (T == QUIET_CHECKS) smove &= checking(pos, QUEEN);
                 while (smove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(smove);
                     pushMove({ BuildMove(pos, toPos, queentype), 0 });
@@ -898,7 +959,7 @@ private:
             int pos = PopPos(notPinnedQueen);
             BitBoard moves = m_Position.QueenAttack(pos, m_Position.m_Board) & moveable;
 
-            if constexpr (T == QUIESCENCE) {
+            if constexpr (captures) {
                 BitBoard qmove = moves & Enemy<white>(m_Position);
                 while (qmove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(qmove);
@@ -907,8 +968,9 @@ private:
                 }
             }
 
-            if constexpr (T == SILENT) {
+            if constexpr (quiets) {
                 BitBoard smove = moves & ~Enemy<white>(m_Position);
+                if constexpr (T == QUIET_CHECKS) smove &= checking(pos, QUEEN);
                 while (smove > 0) { // Loop each bit
                     const BoardPos toPos = PopPos(smove);
                     pushMove({ BuildMove(pos, toPos, queentype), 0 });
@@ -916,12 +978,18 @@ private:
             }
         }
 
-        // King
+        TGenerateKingMoves<white, T>(kingpos, danger, T == QUIET_CHECKS ? checking(kingpos, KING) : 0);
+    }
+
+    template<Color white, MoveGenType T>
+    void TGenerateKingMoves(BoardPos kingpos, BitBoard danger, BitBoard checks = 0) {
+        constexpr Color enemy = !white;
+        constexpr ColoredPieceType kingtype = GetColoredPiece<white>(KING);
 
         BitBoard kmoves = Lookup::king_attacks[kingpos] & ~Player<white>(m_Position);
         kmoves &= ~danger;
 
-        if constexpr (T == QUIESCENCE) {
+        if constexpr (T == QUIESCENCE || T == EVASIONS) {
             BitBoard qkmove = kmoves & Enemy<white>(m_Position);
             while (qkmove > 0) { // Loop each bit
                 const BoardPos toPos = PopPos(qkmove);
@@ -930,8 +998,9 @@ private:
             }
         }
 
-        if constexpr (T == SILENT) {
+        if constexpr (T == SILENT || T == EVASIONS || T == QUIET_CHECKS) {
             BitBoard skmove = kmoves & ~Enemy<white>(m_Position);
+            if constexpr (T == QUIET_CHECKS) skmove &= checks; // The king only ever checks by discovery
             while (skmove > 0) { // Loop each bit
                 const BoardPos toPos = PopPos(skmove);
                 pushMove({ BuildMove(kingpos, toPos, kingtype), 0 });
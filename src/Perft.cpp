@@ -39,6 +39,9 @@ template uint64 Perft<PerftGen::Bulk>(Position&, int);
 uint64 PerftDivide(Position& pos, int depth, bool print) {
     if (depth <= 0) return 1;
 
+    Timer timer;
+    timer.Start();
+
     uint64 total = 0;
     MoveGen gen(pos, 0, false);
     Move move;
@@ -49,6 +52,10 @@ uint64 PerftDivide(Position& pos, int depth, bool print) {
         total += count;
         if (print) printf("%s: %" PRIu64 "\n", MoveToString(move).c_str(), count);
     }
-    if (print) printf("\n%" PRIu64 "\n", total);
+    if (print) {
+        const float seconds = timer.End();
+        printf("\n%" PRIu64 "\n", total);
+        printf("%.0f ms, %.0f nps\n", seconds * 1000, seconds > 0 ? total / seconds : 0.0f);
+    }
     return total;
 }
@@ -1,84 +1,167 @@
-#include <cmath>
+#include <algorithm>
+#include <charconv>
 
 #include "Position.h"
+#include "Movelist.h"
 
-void Position::SetPosition(const std::string& FEN) {
-    m_WhitePawn = FenToMap(FEN, 'P');
-    m_WhiteKnight = FenToMap(FEN, 'N');
-    m_WhiteBishop = FenToMap(FEN, 'B');
-    m_WhiteRook = FenToMap(FEN, 'R');
-    m_WhiteQueen = FenToMap(FEN, 'Q');
-    m_WhiteKing = FenToMap(FEN, 'K');
-    m_BlackPawn = FenToMap(FEN, 'p');
-    m_BlackKnight = FenToMap(FEN, 'n');
-    m_BlackBishop = FenToMap(FEN, 'b');
-    m_BlackRook = FenToMap(FEN, 'r');
-    m_BlackQueen = FenToMap(FEN, 'q');
-    m_BlackKing = FenToMap(FEN, 'k');
-    m_Black = (m_BlackPawn | m_BlackKnight | m_BlackBishop | m_BlackRook | m_BlackQueen | m_BlackKing);
-    m_White = (m_WhitePawn | m_WhiteKnight | m_WhiteBishop | m_WhiteRook | m_WhiteQueen | m_WhiteKing);
-    m_Board = (m_White | m_Black);
-    SetState(FEN);
-    m_Hash = Zobrist_Hash(*this);
-    m_PawnHash = Zobrist_PawnHash(*this);
-    m_States[m_Ply].m_Hash = m_Hash;
-    m_InCheck = m_WhiteMove ? UpdateChecks<WHITE>() : UpdateChecks<BLACK>();
+Position::Position() : m_Ply(0), m_Stack(std::make_unique<StateStack>()) {
+    m_States = m_Stack->m_States.data();
+    m_CheckInfo = m_Stack->m_CheckInfo.data();
 }
 
-void Position::SetState(const std::string& FEN) {
-    m_Ply = 0;
-    size_t i = 0;
-    while (FEN[i++] != ' ') {
-        // Skip piece placement
-    }
+Position::Position(const Position& other)
+    : m_Board(other.m_Board), m_WhiteMove(other.m_WhiteMove), m_FullMoves(other.m_FullMoves), m_Ply(other.m_Ply),
+      m_Hash(other.m_Hash), m_PawnHash(other.m_PawnHash), m_MaterialKey(other.m_MaterialKey),
+      m_InCheck(other.m_InCheck),
+      m_Stack(std::make_unique<StateStack>(std::max<size_t>(other.m_Ply + 1, STATE_STACK_PLIES))) {
+    std::copy(&other.m_Pieces[0][0], &other.m_Pieces[0][0] + 7 * 2, &m_Pieces[0][0]);
+    std::copy(other.m_States, other.m_States + m_Ply + 1, m_Stack->m_States.begin());
+    std::copy(other.m_CheckInfo, other.m_CheckInfo + m_Ply + 1, m_Stack->m_CheckInfo.begin());
+    m_States = m_Stack->m_States.data();
+    m_CheckInfo = m_Stack->m_CheckInfo.data();
+}
 
-    char ac = FEN[i++]; // Active color
-    switch (ac) {
-    case 'w': m_WhiteMove = WHITE; break;
-    case 'b': m_WhiteMove = BLACK; break;
-    default: printf("Invalid FEN for active color\n"); return;
-    }
+Position& Position::operator=(const Position& other) {
+    if (this != &other) *this = Position(other);
+    return *this;
+}
 
-    i++;
-    m_States[m_Ply].m_CastleRights = 0;
-    char c = {};
-    while ((c = FEN[i++]) != ' ') {
-        if (c == '-') {
-            break;
-        }
+void Position::Grow() {
+    m_Stack->m_States.resize(m_Stack->m_States.size() * 2);
+    m_Stack->m_CheckInfo.resize(m_Stack->m_CheckInfo.size() * 2);
+    m_States = m_Stack->m_States.data();
+    m_CheckInfo = m_Stack->m_CheckInfo.data();
+}
 
-        switch (c) {
-        case 'K': m_States[m_Ply].m_CastleRights |= CASTLE_WHITEKING; break;
-        case 'Q': m_States[m_Ply].m_CastleRights |= CASTLE_WHITEQUEEN; break;
-        case 'k': m_States[m_Ply].m_CastleRights |= CASTLE_BLACKKING; break;
-        case 'q': m_States[m_Ply].m_CastleRights |= CASTLE_BLACKQUEEN; break;
-        }
+const char* FenErrorString(FenError error) {
+    switch (error) {
+    case FEN_OK: return "ok";
+    case FEN_PLACEMENT: return "bad piece placement";
+    case FEN_KINGS: return "needs one king a side";
+    case FEN_SIDE: return "bad side to move";
+    case FEN_CASTLING: return "bad castling rights";
+    case FEN_EN_PASSANT: return "bad en passant square";
+    case FEN_COUNTERS: return "bad move counters";
     }
+    return "unknown";
+}
+
+// Index is (type - 1) + 6 * color, the same order as the zobrist keys
+static constexpr std::string_view pieceLetters = "PNBRQKpnbrqk";
 
-    while ((c = FEN[i]) == ' ') i++;
-    char a = FEN[i++];
+FenError Position::SetPosition(std::string_view FEN) {
+    BitBoard pieces[7][2] = {};
+    uint64 hash = 0;
+    uint64 pawnHash = 0;
 
-    if (a != '-') {
-        if (m_WhiteMove) {
-            m_States[m_Ply].m_EnPassant = 1ull << (40 + ('h' - a)); // TODO: need to be tested
+    // Piece placement, a8 first and h1 last
+    size_t i = 0;
+    int sq = 63;
+    int file = 0;
+    for (; i < FEN.size() && FEN[i] != ' '; i++) {
+        const char c = FEN[i];
+        if (c == '/') {
+            if (file != 8 || sq < 0) return FEN_PLACEMENT;
+            file = 0;
+        } else if (c >= '1' && c <= '8') {
+            file += c - '0';
+            sq -= c - '0';
+            if (file > 8) return FEN_PLACEMENT;
         } else {
-            m_States[m_Ply].m_EnPassant = 1ull << (16 + ('h' - a)); // TODO: need to be tested
+            const size_t index = pieceLetters.find(c);
+            if (index == std::string_view::npos || file >= 8) return FEN_PLACEMENT;
+            const int type = index % 6 + 1;
+            const int color = index / 6;
+            if (type == PAWN && (sq < 8 || sq >= 56)) return FEN_PLACEMENT;
+
+            const uint64 key = Lookup::zobrist[(2 * (type - 1) + color) * 64 + sq];
+            pieces[type][color] |= 1ull << sq;
+            hash ^= key;
+            if (type == PAWN) pawnHash ^= key;
+            file++;
+            sq--;
         }
-    } else {
-        m_States[m_Ply].m_EnPassant = 0;
+    }
+    if (file != 8 || sq != -1) return FEN_PLACEMENT;
+    if (CountBits(pieces[KING][0]) != 1 || CountBits(pieces[KING][1]) != 1) return FEN_KINGS;
+
+    auto field = [&]() {
+        while (i < FEN.size() && FEN[i] == ' ') i++;
+        const size_t begin = i;
+        while (i < FEN.size() && FEN[i] != ' ') i++;
+        return FEN.substr(begin, i - begin);
+    };
+
+    const std::string_view side = field();
+    if (side != "w" && side != "b") return FEN_SIDE;
+    const Color white = side == "w" ? WHITE : BLACK;
+
+    const std::string_view castling = field();
+    uint8 castleRights = 0;
+    if (castling != "-") {
+        if (castling.empty()) return FEN_CASTLING;
+        for (char c : castling) {
+            const size_t index = std::string_view("KQkq").find(c);
+            if (index == std::string_view::npos || (castleRights & (1 << index))) return FEN_CASTLING;
+            castleRights |= 1 << index;
+        }
+    }
+
+    const std::string_view enPassant = field();
+    BitBoard enPassantSquare = 0;
+    if (enPassant != "-") {
+        if (enPassant.size() != 2 || enPassant[0] < 'a' || enPassant[0] > 'h' || enPassant[1] != (white ? '6' : '3'))
+            return FEN_EN_PASSANT;
+        const int target = (white ? 40 : 16) + ('h' - enPassant[0]);
+        const BitBoard pushed = white ? pieces[PAWN][1] & (1ull << (target - 8)) : pieces[PAWN][0] & (1ull << (target + 8));
+        if (!pushed) return FEN_EN_PASSANT;
+        enPassantSquare = 1ull << target;
     }
 
-    m_States[m_Ply].m_HalfMoves = 0;
-    m_FullMoves = 0;
-    int t = 1;
+    // EPD lines and hand typed FENs often end early
+    auto counter = [&](uint64 fallback, uint64& value) {
+        const std::string_view digits = field();
+        value = fallback;
+        if (digits.empty()) return true;
+        const auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+        return error == std::errc() && end == digits.data() + digits.size();
+    };
+    uint64 halfMoves, fullMoves;
+    if (!counter(0, halfMoves) || !counter(1, fullMoves)) return FEN_COUNTERS;
+
+    for (int type = PAWN; type <= KING; type++) {
+        m_Pieces[type][0] = pieces[type][0];
+        m_Pieces[type][1] = pieces[type][1];
+    }
+    m_White = m_WhitePawn | m_WhiteKnight | m_WhiteBishop | m_WhiteRook | m_WhiteQueen | m_WhiteKing;
+    m_Black = m_BlackPawn | m_BlackKnight | m_BlackBishop | m_BlackRook | m_BlackQueen | m_BlackKing;
+    m_Board = m_White | m_Black;
+    m_WhiteMove = white;
+    m_FullMoves = fullMoves;
+    m_Ply = 0;
 
-    while ((c = FEN[i++]) != ' ');
-    while ((c = FEN[i++]) != ' ') m_States[m_Ply].m_HalfMoves = m_States[m_Ply].m_HalfMoves * 10 + (int)(c - '0');
-    while (i < FEN.size() && FEN[i] >= '0' && FEN[i] <= '9') {
-        c = FEN[i++];
-        m_FullMoves = m_FullMoves * 10 + (c - '0');
+    if (white) hash ^= Lookup::zobrist[64 * 12];
+    for (int right = 0; right < 4; right++) {
+        if (castleRights & (1 << right)) hash ^= Lookup::zobrist[64 * 12 + 1 + right];
     }
+    if (enPassantSquare) hash ^= Lookup::zobrist[64 * 12 + 5 + GetSquare(enPassantSquare) % 8];
+    m_Hash = hash;
+    m_PawnHash = pawnHash;
+    m_MaterialKey = Zobrist_MaterialKey(*this);
+
+    m_States[m_Ply].m_CastleRights = castleRights;
+    m_States[m_Ply].m_HalfMoves = (uint8)std::min<uint64>(halfMoves, 255);
+    m_States[m_Ply].m_PliesFromNull = 0;
+    m_States[m_Ply].m_EnPassant = enPassantSquare;
+    m_States[m_Ply].m_Hash = m_Hash;
+    m_States[m_Ply].m_PawnHash = m_PawnHash;
+    m_States[m_Ply].m_MaterialKey = m_MaterialKey;
+    m_InCheck = m_WhiteMove ? UpdateChecks<WHITE>() : UpdateChecks<BLACK>();
+    m_States[m_Ply].m_InCheck = m_InCheck;
+    m_CheckInfo[m_Ply].m_Valid = false;
+    return FEN_OK;
 }
+
 BitBoard Position::RookAttack(int pos, BitBoard occ) const {
     Lookup::BlackMagic m = Lookup::r_magics[pos];
     return m.attacks[((occ | m.mask) * m.hash) >> (64 - 12)];
@@ -104,6 +187,15 @@ BitBoard Position::BishopXray(int pos, BitBoard occ) const {
 }
 
 void Position::MovePiece(Move move) {
+    m_WhiteMove ? TMovePiece<WHITE>(move) : TMovePiece<BLACK>(move);
+}
+
+void Position::UndoMove(Move move) {
+    m_WhiteMove ? TUndoMove<BLACK>(move) : TUndoMove<WHITE>(move);
+}
+
+template<Color white>
+void Position::TMovePiece(Move move) {
     const int fPos = From(move);
     const int tPos = To(move);
     const BitBoard to = (1ull << tPos);
@@ -113,16 +205,21 @@ void Position::MovePiece(Move move) {
     const int promotion = Promotion(move);
     const bool enPassant = EnPassant(move);
 
+    // Once this node has its checking squares the move is cheaper to test than the position it leads to
+    const bool knownCheck = m_CheckInfo[m_Ply].m_Valid;
+    const bool givesCheck = knownCheck && TGivesCheck<white>(move);
 
     if (m_States[m_Ply].m_EnPassant) { // Remove old en passant from hash
         m_Hash ^= Lookup::zobrist[64 * 12 + 5 + (GetSquare(m_States[m_Ply].m_EnPassant) & 0x7)];
     }
 
+    Reserve();
     m_Ply++;
     m_States[m_Ply] = m_States[m_Ply - 1];
 
     m_States[m_Ply].m_HalfMoves++;
-    if (!m_WhiteMove) m_FullMoves++;
+    if (m_States[m_Ply].m_PliesFromNull < 255) m_States[m_Ply].m_PliesFromNull++;
+    if constexpr (!white) m_FullMoves++;
 
 
     m_States[m_Ply].m_EnPassant = 0;
@@ -388,17 +485,34 @@ void Position::MovePiece(Move move) {
     case WKING:
     case BKING: break; // Kings are never captured
     }
+
+    // The counts after the move pick the keys
+    if (capture != NOPIECE) {
+        const int type = (capture - 1) % 6 + 1, color = capture > WKING;
+        m_MaterialKey ^= MaterialZobrist(type, color, CountBits(m_Pieces[type][color]));
+    }
+    if (promotion) {
+        const int type = GetSquare(promotion) - 20, color = !white;
+        m_MaterialKey ^= MaterialZobrist(PAWN, color, CountBits(m_Pieces[PAWN][color]))
+                         ^ MaterialZobrist(type, color, CountBits(m_Pieces[type][color]) - 1);
+    }
+
     m_Black = (m_BlackPawn | m_BlackKnight | m_BlackBishop | m_BlackRook | m_BlackQueen | m_BlackKing);
     m_White = (m_WhitePawn | m_WhiteKnight | m_WhiteBishop | m_WhiteRook | m_WhiteQueen | m_WhiteKing);
     m_Board = (m_White | m_Black);
 
-    m_WhiteMove = !m_WhiteMove;
+    m_WhiteMove = !white;
     m_States[m_Ply].m_Hash = m_Hash;
 
-    m_InCheck = m_WhiteMove ? UpdateChecks<WHITE>() : UpdateChecks<BLACK>();
+    m_States[m_Ply].m_PawnHash = m_PawnHash;
+    m_States[m_Ply].m_MaterialKey = m_MaterialKey;
+    m_InCheck = knownCheck ? givesCheck : UpdateChecks<!white>();
+    m_States[m_Ply].m_InCheck = m_InCheck;
+    m_CheckInfo[m_Ply].m_Valid = false;
 }
 
-void Position::UndoMove(Move move) {
+template<Color white>
+void Position::TUndoMove(Move move) {
     const int tPos = To(move);
     const int fPos = From(move);
     const BitBoard to = (1ull << tPos);
@@ -406,13 +520,14 @@ void Position::UndoMove(Move move) {
     const BitBoard swp = (from) | (to);
     const int promotion = Promotion(move);
 
+    // Everything the move can not give back by itself was kept in the state
     m_Ply--;
     m_Hash = m_States[m_Ply].m_Hash;
+    m_PawnHash = m_States[m_Ply].m_PawnHash;
+    m_MaterialKey = m_States[m_Ply].m_MaterialKey;
+    m_InCheck = m_States[m_Ply].m_InCheck;
 
-    if (m_WhiteMove) m_FullMoves--;
-
-    m_PawnHash ^= Lookup::zobrist[64 * 12];
-
+    if constexpr (!white) m_FullMoves--;
 
     const ColoredPieceType type = MovePieceType(move);
 
@@ -422,28 +537,23 @@ void Position::UndoMove(Move move) {
         if (promotion) {
             switch (promotion) {
             case 0x400000:
-                m_PawnHash ^= Lookup::zobrist[fPos];
                 m_WhitePawn ^= from;
                 m_WhiteKnight ^= to;
                 break;
             case 0x800000:
-                m_PawnHash ^= Lookup::zobrist[fPos];
                 m_WhitePawn ^= from;
                 m_WhiteBishop ^= to;
                 break;
             case 0x1000000:
-                m_PawnHash ^= Lookup::zobrist[fPos];
                 m_WhitePawn ^= from;
                 m_WhiteRook ^= to;
                 break;
             case 0x2000000:
-                m_PawnHash ^= Lookup::zobrist[fPos];
                 m_WhitePawn ^= from;
                 m_WhiteQueen ^= to;
                 break;
             }
         } else {
-            m_PawnHash ^= Lookup::zobrist[tPos] ^ Lookup::zobrist[fPos];
             m_WhitePawn ^= swp;
         }
         break;
@@ -465,28 +575,23 @@ void Position::UndoMove(Move move) {
         if (promotion) {
             switch (promotion) {
             case 0x400000:
-                m_PawnHash ^= Lookup::zobrist[64 + fPos];
                 m_BlackPawn ^= from;
                 m_BlackKnight ^= to;
                 break;
             case 0x800000:
-                m_PawnHash ^= Lookup::zobrist[64 + fPos];
                 m_BlackPawn ^= from;
                 m_BlackBishop ^= to;
                 break;
             case 0x1000000:
-                m_PawnHash ^= Lookup::zobrist[64 + fPos];
                 m_BlackPawn ^= from;
                 m_BlackRook ^= to;
                 break;
             case 0x2000000:
-                m_PawnHash ^= Lookup::zobrist[64 + fPos];
                 m_BlackPawn ^= from;
                 m_BlackQueen ^= to;
                 break;
             }
         } else {
-            m_PawnHash ^= Lookup::zobrist[64 + tPos] ^ Lookup::zobrist[64 + fPos];
             m_BlackPawn ^= swp;
         }
         break;
@@ -513,10 +618,8 @@ void Position::UndoMove(Move move) {
         // White pieces
     case BPAWN:
         if (EnPassant(move)) {
-            m_PawnHash ^= Lookup::zobrist[56 + tPos];
             m_BlackPawn ^= (to >> 8);
         } else {
-            m_PawnHash ^= Lookup::zobrist[64 + tPos];
             m_BlackPawn ^= to;
         }
         break;
@@ -529,10 +632,8 @@ void Position::UndoMove(Move move) {
         // Black pieces
     case WPAWN:
         if (EnPassant(move)) {
-            m_PawnHash ^= Lookup::zobrist[8 + tPos];
             m_WhitePawn ^= (to << 8);
         } else {
-            m_PawnHash ^= Lookup::zobrist[tPos];
             m_WhitePawn ^= to;
         }
         break;
@@ -551,32 +652,367 @@ void Position::UndoMove(Move move) {
     m_White = (m_WhitePawn | m_WhiteKnight | m_WhiteBishop | m_WhiteRook | m_WhiteQueen | m_WhiteKing);
     m_Board = (m_White | m_Black);
 
-    m_WhiteMove = !m_WhiteMove;
-    m_InCheck = m_WhiteMove ? UpdateChecks<WHITE>() : UpdateChecks<BLACK>();
+    m_WhiteMove = white;
 }
 
 void Position::NullMove() {
     if (m_States[m_Ply].m_EnPassant) { // Remove old en passant from hash
         m_Hash ^= Lookup::zobrist[64 * 12 + 5 + (GetSquare(m_States[m_Ply].m_EnPassant) & 0x7)];
     }
+    Reserve();
     m_Ply++;
     m_States[m_Ply] = m_States[m_Ply - 1];
     m_States[m_Ply].m_HalfMoves++;
+    m_States[m_Ply].m_PliesFromNull = 0;
     if (!m_WhiteMove) m_FullMoves++;
     m_States[m_Ply].m_EnPassant = 0;
     m_Hash ^= Lookup::zobrist[64 * 12]; // White Move
     m_PawnHash ^= Lookup::zobrist[64 * 12];
     m_WhiteMove = !m_WhiteMove;
     m_States[m_Ply].m_Hash = m_Hash;
+    m_States[m_Ply].m_PawnHash = m_PawnHash;
     m_InCheck = m_WhiteMove ? UpdateChecks<WHITE>() : UpdateChecks<BLACK>();
+    m_States[m_Ply].m_InCheck = m_InCheck;
+    m_CheckInfo[m_Ply].m_Valid = false;
 }
 void Position::UndoNullMove() {
     m_Ply--;
     m_Hash = m_States[m_Ply].m_Hash;
+    m_PawnHash = m_States[m_Ply].m_PawnHash;
+    m_InCheck = m_States[m_Ply].m_InCheck;
     if (m_WhiteMove) m_FullMoves--;
-    m_PawnHash ^= Lookup::zobrist[64 * 12];
     m_WhiteMove = !m_WhiteMove;
-    m_InCheck = m_WhiteMove ? UpdateChecks<WHITE>() : UpdateChecks<BLACK>();
+}
+
+template<Color white>
+bool Position::Attacked(int sq, BitBoard occ, BitBoard removed) const {
+    constexpr Color enemy = !white;
+    const BitBoard keep = ~removed;
+    const BitBoard bit = 1ull << sq;
+
+    // An enemy pawn attacks sq from the squares our own pawn on sq would attack
+    return (Lookup::knight_attacks[sq] & Knight<enemy>() & keep)
+           || ((PawnAttackLeft<white>(bit) | PawnAttackRight<white>(bit)) & Pawn<enemy>() & keep)
+           || (Lookup::king_attacks[sq] & King<enemy>())
+           || (BishopAttack(sq, occ) & (Bishop<enemy>() | Queen<enemy>()) & keep)
+           || (RookAttack(sq, occ) & (Rook<enemy>() | Queen<enemy>()) & keep);
+}
+
+template<Color white>
+bool Position::TIsPseudoLegal(Move move) const {
+    constexpr Color enemy = !white;
+    constexpr int side = white ? 0 : 1; // Column of m_Pieces
+    const int fPos = From(move);
+    const int tPos = To(move);
+    const BitBoard from = 1ull << fPos;
+    const BitBoard to = 1ull << tPos;
+    const ColoredPieceType type = MovePieceType(move);
+    const ColoredPieceType capture = CaptureType(move);
+    const int promotion = Promotion(move);
+
+    if (move >> 26) return false; // Bits no move uses
+
+    if (type < GetColoredPiece<white>(PAWN) || type > GetColoredPiece<white>(KING)) return false;
+    const int piece = type - GetColoredPiece<white>(PAWN) + PAWN;
+    if (!(m_Pieces[piece][side] & from) || (to & m_Pieces[0][side])) return false;
+
+    if (EnPassant(move)) {
+        if (piece != PAWN || capture != GetColoredPiece<enemy>(PAWN) || !(to & m_States[m_Ply].m_EnPassant))
+            return false;
+    } else if (capture == NOPIECE) {
+        if (to & m_Board) return false;
+    } else {
+        // Kings are never captured
+        if (capture < GetColoredPiece<enemy>(PAWN) || capture > GetColoredPiece<enemy>(QUEEN)) return false;
+        if (!(m_Pieces[capture - GetColoredPiece<enemy>(PAWN) + PAWN][1 - side] & to)) return false;
+    }
+
+    if (promotion) {
+        if (piece != PAWN || !(to & FirstRank<enemy>()) || (promotion & (promotion - 1))) return false;
+    } else if (piece == PAWN && (to & FirstRank<enemy>())) {
+        return false;
+    }
+
+    if (Castle(move) && piece != KING) return false;
+
+    switch (piece) {
+    case PAWN:
+        if (capture != NOPIECE) return (PawnAttackLeft<white>(from) | PawnAttackRight<white>(from)) & to;
+        if (PawnForward<white>(from) == to) return true;
+        return (from & Lookup::StartingPawnRank<white>()) && Pawn2Forward<white>(from) == to
+               && !(PawnForward<white>(from) & m_Board);
+    case KNIGHT: return Lookup::knight_attacks[fPos] & to;
+    case BISHOP: return BishopAttack(fPos, m_Board) & to;
+    case ROOK: return RookAttack(fPos, m_Board) & to;
+    case QUEEN: return QueenAttack(fPos, m_Board) & to;
+    case KING:
+        if (!Castle(move)) return Lookup::king_attacks[fPos] & to;
+        {
+            constexpr int shift = white ? 0 : 56;
+            const uint8 rights = m_States[m_Ply].m_CastleRights;
+            if (capture != NOPIECE || fPos != 3 + shift) return false;
+            if (tPos == 1 + shift) { // King side castle
+                return (rights & (white ? CASTLE_WHITEKING : CASTLE_BLACKKING)) && !(m_Board & (0b110ull << shift))
+                       && (Rook<white>() & (1ull << shift));
+            }
+            if (tPos == 5 + shift) {
+                return (rights & (white ? CASTLE_WHITEQUEEN : CASTLE_BLACKQUEEN))
+                       && !(m_Board & (0b01110000ull << shift)) && (Rook<white>() & (0b10000000ull << shift));
+            }
+        }
+        return false;
+    }
+    return false;
+}
+
+template<Color white>
+bool Position::TIsLegal(Move move) const {
+    constexpr Color enemy = !white;
+    const int fPos = From(move);
+    const int tPos = To(move);
+    const BitBoard from = 1ull << fPos;
+    const BitBoard to = 1ull << tPos;
+
+    if (MovePieceType(move) == GetColoredPiece<white>(KING)) {
+        if (Castle(move)) {
+            // The king may not castle out of, through or into check
+            const int passed = tPos == 1 || tPos == 57 ? tPos + 1 : tPos - 1;
+            return !m_InCheck && !Attacked<white>(passed, m_Board, 0) && !Attacked<white>(tPos, m_Board, 0);
+        }
+        // Take the king off the board so a slider can not hide behind it
+        return !Attacked<white>(tPos, m_Board ^ from, to);
+    }
+
+    const int kingsq = GetSquare(King<white>());
+
+    // Off every line through the king the piece can not be pinned, and out of check nothing else matters
+    if (!m_InCheck && !EnPassant(move) && !Lookup::active_moves[kingsq * 64 + fPos]) return true;
+
+    const BitBoard captured = EnPassant(move) ? PawnForward<enemy>(to) : to;
+    const BitBoard occ = ((m_Board ^ from) & ~captured) | to;
+    return !Attacked<white>(kingsq, occ, captured);
+}
+
+template<Color white>
+const CheckInfo& Position::TGetCheckInfo() const {
+    constexpr Color enemy = !white;
+    CheckInfo& info = m_CheckInfo[m_Ply];
+    if (info.m_Valid) return info;
+
+    const int kingsq = GetSquare(King<enemy>());
+    // Our pawn attacks the king from the squares an enemy pawn on the king's square would attack
+    info.m_Squares[NONE] = 0;
+    info.m_Squares[PAWN] = PawnAttackLeft<enemy>(King<enemy>()) | PawnAttackRight<enemy>(King<enemy>());
+    info.m_Squares[KNIGHT] = Lookup::knight_attacks[kingsq];
+    info.m_Squares[BISHOP] = BishopAttack(kingsq, m_Board);
+    info.m_Squares[ROOK] = RookAttack(kingsq, m_Board);
+    info.m_Squares[QUEEN] = info.m_Squares[BISHOP] | info.m_Squares[ROOK];
+    info.m_Squares[KING] = 0;
+
+    info.m_Blockers = 0;
+    BitBoard snipers = (RookXray(kingsq, m_Board) & (Rook<white>() | Queen<white>()))
+                       | (BishopXray(kingsq, m_Board) & (Bishop<white>() | Queen<white>()));
+    while (snipers > 0) {
+        const int pos = PopPos(snipers);
+        info.m_Blockers |= Lookup::active_moves[kingsq * 64 + pos] & Player<white>(*this) & ~(1ull << pos);
+    }
+    info.m_Valid = true;
+    return info;
+}
+
+template<Color white>
+bool Position::TGivesCheck(Move move) const {
+    constexpr Color enemy = !white;
+    const CheckInfo& info = TGetCheckInfo<white>();
+    const int fPos = From(move);
+    const int tPos = To(move);
+    const BitBoard from = 1ull << fPos;
+    const BitBoard to = 1ull << tPos;
+    const int kingsq = GetSquare(King<enemy>());
+    const int promotion = Promotion(move);
+
+    // Direct check, a promoted pawn is looked at below
+    const PieceType type = (PieceType)(white ? MovePieceType(move) : MovePieceType(move) - 6);
+    if (!promotion && (info.m_Squares[type] & to)) return true;
+
+    // Discovered check, unless the piece stays on the line it was blocking
+    if ((info.m_Blockers & from) && !(Lookup::LineThrough(kingsq, fPos) & to)) return true;
+
+    if (promotion) {
+        const BitBoard occ = (m_Board ^ from) | to;
+        switch (promotion) {
+        case 0x400000: return Lookup::knight_attacks[tPos] & King<enemy>();
+        case 0x800000: return BishopAttack(tPos, occ) & King<enemy>();
+        case 0x1000000: return RookAttack(tPos, occ) & King<enemy>();
+        case 0x2000000: return QueenAttack(tPos, occ) & King<enemy>();
+        }
+    }
+
+    // Removing the captured pawn can uncover one of our sliders
+    if (EnPassant(move)) {
+        const BitBoard occ = ((m_Board ^ from) & ~PawnForward<enemy>(to)) | to;
+        return (RookAttack(kingsq, occ) & (Rook<white>() | Queen<white>()))
+               || (BishopAttack(kingsq, occ) & (Bishop<white>() | Queen<white>()));
+    }
+
+    // The rook is the one that can check
+    if (Castle(move)) {
+        const int rookFrom = tPos == 1 || tPos == 57 ? tPos - 1 : tPos + 2;
+        const int rookTo = tPos == 1 || tPos == 57 ? tPos + 1 : tPos - 1;
+        const BitBoard occ = m_Board ^ from ^ to ^ (1ull << rookFrom) ^ (1ull << rookTo);
+        return RookAttack(rookTo, occ) & King<enemy>();
+    }
+    return false;
+}
+
+// The swap list kept as one running balance, as in Stockfish. Each capture flips whose turn it is to be satisfied,
+// and sliders behind a piece that has taken join in once it leaves.
+template<Color white>
+bool Position::TSeeGe(Move move, int threshold) const {
+    if (Castle(move) || Promotion(move)) return threshold <= 0;
+
+    const int tPos = To(move);
+    const BitBoard to = 1ull << tPos;
+    int swap = OrderingPieceValue(CaptureType(move)) - threshold;
+    if (swap < 0) return false; // Even taking for free falls short
+    swap = OrderingPieceValue(MovePieceType(move)) - swap;
+    if (swap <= 0) return true; // Losing the piece for nothing still makes it
+
+    BitBoard occ = m_Board ^ (1ull << From(move)) ^ to;
+    if (EnPassant(move)) occ ^= white ? to >> 8 : to << 8;
+
+    const BitBoard diagonal = m_WhiteBishop | m_BlackBishop | m_WhiteQueen | m_BlackQueen;
+    const BitBoard straight = m_WhiteRook | m_BlackRook | m_WhiteQueen | m_BlackQueen;
+    BitBoard attackers = (Lookup::knight_attacks[tPos] & (m_WhiteKnight | m_BlackKnight))
+                         | (Lookup::king_attacks[tPos] & (m_WhiteKing | m_BlackKing))
+                         | ((PawnAttackLeft<BLACK>(to) | PawnAttackRight<BLACK>(to)) & m_WhitePawn)
+                         | ((PawnAttackLeft<WHITE>(to) | PawnAttackRight<WHITE>(to)) & m_BlackPawn)
+                         | (BishopAttack(tPos, occ) & diagonal) | (RookAttack(tPos, occ) & straight);
+
+    int side = white ? 0 : 1; // Column of m_Pieces of the side that just took
+    bool result = true;
+    while (true) {
+        side ^= 1;
+        attackers &= occ;
+        const BitBoard ours = attackers & m_Pieces[0][side];
+        if (!ours) break;
+        result = !result;
+
+        int type = PAWN;
+        while (!(ours & m_Pieces[type][side])) type++;
+        if (type == KING) {
+            // The king may only take last, with nothing left to take it back
+            return (attackers & ~m_Pieces[0][side]) ? !result : result;
+        }
+        swap = OrderingPieceValue(ColoredPieceType(type)) - swap;
+        if (swap < result) break;
+
+        const BitBoard piece = ours & m_Pieces[type][side];
+        occ ^= piece & (0 - piece);
+        if (type == PAWN || type == BISHOP || type == QUEEN) attackers |= BishopAttack(tPos, occ) & diagonal;
+        if (type == ROOK || type == QUEEN) attackers |= RookAttack(tPos, occ) & straight;
+    }
+    return result;
+}
+
+bool Position::SeeGe(Move move, int threshold) const {
+    return m_WhiteMove ? TSeeGe<WHITE>(move, threshold) : TSeeGe<BLACK>(move, threshold);
+}
+
+bool Position::GivesCheck(Move move) const {
+    return m_WhiteMove ? TGivesCheck<WHITE>(move) : TGivesCheck<BLACK>(move);
+}
+
+const CheckInfo& Position::GetCheckInfo() const {
+    return m_WhiteMove ? TGetCheckInfo<WHITE>() : TGetCheckInfo<BLACK>();
+}
+
+// The search knows whose move it is and calls these directly
+template void Position::TMovePiece<WHITE>(Move);
+template void Position::TMovePiece<BLACK>(Move);
+template void Position::TUndoMove<WHITE>(Move);
+template void Position::TUndoMove<BLACK>(Move);
+template bool Position::TIsPseudoLegal<WHITE>(Move) const;
+template bool Position::TIsPseudoLegal<BLACK>(Move) const;
+template bool Position::TIsLegal<WHITE>(Move) const;
+template bool Position::TIsLegal<BLACK>(Move) const;
+template bool Position::TGivesCheck<WHITE>(Move) const;
+template bool Position::TGivesCheck<BLACK>(Move) const;
+template bool Position::TSeeGe<WHITE>(Move, int) const;
+template bool Position::TSeeGe<BLACK>(Move, int) const;
+template const CheckInfo& Position::TGetCheckInfo<WHITE>() const;
+template const CheckInfo& Position::TGetCheckInfo<BLACK>() const;
+
+// Every reversible move, a piece other than a pawn going from one square to another, keyed by the hash change it
+// makes. Two probes find a move if it is there: a cuckoo table.
+struct CuckooTable {
+    std::array<uint64, 8192> m_Keys;
+    std::array<Move, 8192> m_Moves;
+};
+
+static constexpr int CuckooH1(uint64 key) { return key & 0x1fff; }
+static constexpr int CuckooH2(uint64 key) { return (key >> 16) & 0x1fff; }
+
+static consteval CuckooTable InitCuckoo() {
+    CuckooTable table{};
+    for (int type = KNIGHT; type <= KING; type++) {
+        for (int color = 0; color < 2; color++) {
+            const int zobrist = (2 * (type - 1) + color) * 64;
+            for (int from = 0; from < 64; from++) {
+                const uint64 lines = Lookup::lines[from * 4 + 0] | Lookup::lines[from * 4 + 1];
+                const uint64 diags = Lookup::lines[from * 4 + 2] | Lookup::lines[from * 4 + 3];
+                const uint64 reach = type == KNIGHT ? Lookup::knight_attacks[from]
+                                   : type == BISHOP ? diags
+                                   : type == ROOK   ? lines
+                                   : type == QUEEN  ? lines | diags
+                                                    : Lookup::king_attacks[from];
+                for (int to = from + 1; to < 64; to++) {
+                    if (!(reach & (1ull << to))) continue;
+                    Move move = BuildMove(from, to, ColoredPieceType(type + 6 * color));
+                    uint64 key = Lookup::zobrist[zobrist + from] ^ Lookup::zobrist[zobrist + to] ^ Lookup::zobrist[64 * 12];
+                    // Displace whatever sits in our slot to its other slot until an empty one turns up
+                    for (int i = CuckooH1(key);;) {
+                        std::swap(table.m_Keys[i], key);
+                        std::swap(table.m_Moves[i], move);
+                        if (move == 0) break;
+                        i = i == CuckooH1(key) ? CuckooH2(key) : CuckooH1(key);
+                    }
+                }
+            }
+        }
+    }
+    return table;
+}
+
+static constexpr CuckooTable cuckoo = InitCuckoo();
+
+bool Position::UpcomingRepetition(int ply) const {
+    const int end = std::min<int>({ m_States[m_Ply].m_HalfMoves, m_States[m_Ply].m_PliesFromNull, m_Ply });
+    // A single reversible move takes the side to move back to a position seen an odd number of plies ago. Three
+    // plies is the earliest, one of those moves being ours. A null move is not a move of the game, so the positions
+    // before it can not come back.
+    for (int i = 3; i <= end; i += 2) {
+        const uint64 key = m_Hash ^ m_States[m_Ply - i].m_Hash;
+        int slot = CuckooH1(key);
+        if (cuckoo.m_Keys[slot] != key) slot = CuckooH2(key);
+        if (cuckoo.m_Keys[slot] != key) continue;
+
+        // The piece must be ours and have a free path, the table keeps From below To. Only count it inside the
+        // tree, before the root the draw is not ours to claim yet.
+        const Move move = cuckoo.m_Moves[slot];
+        const BitBoard ends = (1ull << From(move)) | (1ull << To(move));
+        const BitBoard between = Lookup::LineThrough(From(move), To(move)) & ((1ull << To(move)) - (2ull << From(move)));
+        if ((ends & (m_WhiteMove ? m_White : m_Black)) && !(between & m_Board) && ply > i) return true;
+    }
+    return false;
+}
+
+bool Position::IsPseudoLegal(Move move) const {
+    return m_WhiteMove ? TIsPseudoLegal<WHITE>(move) : TIsPseudoLegal<BLACK>(move);
+}
+
+bool Position::IsLegal(Move move) const {
+    return m_WhiteMove ? TIsLegal<WHITE>(move) : TIsLegal<BLACK>(move);
 }
 
 uint64 Zobrist_Hash(const Position& position) {
@@ -662,126 +1098,54 @@ uint64 Zobrist_Hash(const Position& position) {
 }
 
 std::string Position::ToFen() const {
-    std::string FEN;
-    FEN.reserve(27); // Shortest FEN could be: k7/8/8/8/8/8/8/7K w - - 0 1
+    // 71 characters of placement at most, the rest fits easily
+    char FEN[128];
+    char* out = FEN;
 
     // Board
-    int skip = 0; // Count number of empty positions in each rank
-    for (int i = 63; i >= 0; i--) {
-        uint64 pos = 1ull << i;
-
-        if (i % 8 == 7) {
-            if (skip > 0) {
-                FEN += (char)('0' + skip);
-                skip = 0;
+    for (int rank = 7; rank >= 0; rank--) {
+        int skip = 0; // Count number of empty positions in the rank
+        for (int sq = rank * 8 + 7; sq >= rank * 8; sq--) {
+            const BitBoard pos = 1ull << sq;
+            if (!(m_Board & pos)) {
+                skip++;
+                continue;
             }
-            if (i != 63) FEN += '/';
-        }
-
-        if (!(m_Board & pos)) {
-            skip++;
-            continue;
-        } else if (skip > 0) {
-            FEN += (char)('0' + skip);
+            if (skip > 0) *out++ = (char)('0' + skip);
             skip = 0;
+            const int color = (m_Black & pos) ? 1 : 0;
+            int type = PAWN;
+            while (type < KING && !(m_Pieces[type][color] & pos)) type++;
+            *out++ = pieceLetters[(type - 1) + 6 * color];
         }
-
-        if ((m_BlackPawn & pos) > 0) {
-            FEN += "p";
-            continue;
-        }
-        if ((m_BlackKnight & pos) > 0) {
-            FEN += "n";
-            continue;
-        }
-        if ((m_BlackBishop & pos) > 0) {
-            FEN += "b";
-            continue;
-        }
-        if ((m_BlackRook & pos) > 0) {
-            FEN += "r";
-            continue;
-        }
-        if ((m_BlackQueen & pos) > 0) {
-            FEN += "q";
-            continue;
-        }
-        if ((m_BlackKing & pos) > 0) {
-            FEN += "k";
-            continue;
-        }
-        if ((m_WhitePawn & pos) > 0) {
-            FEN += "P";
-            continue;
-        }
-        if ((m_WhiteKnight & pos) > 0) {
-            FEN += "N";
-            continue;
-        }
-        if ((m_WhiteBishop & pos) > 0) {
-            FEN += "B";
-            continue;
-        }
-        if ((m_WhiteRook & pos) > 0) {
-            FEN += "R";
-            continue;
-        }
-        if ((m_WhiteQueen & pos) > 0) {
-            FEN += "Q";
-            continue;
-        }
-        if ((m_WhiteKing & pos) > 0) {
-            FEN += "K";
-            continue;
-        }
+        if (skip > 0) *out++ = (char)('0' + skip);
+        if (rank > 0) *out++ = '/';
     }
 
-    if (skip > 0) {
-        FEN += (char)('0' + skip);
-        skip = 0;
-    }
-
-
-    if (m_WhiteMove) {
-        FEN += " w ";
-    } else {
-        FEN += " b ";
-    }
+    *out++ = ' ';
+    *out++ = m_WhiteMove ? 'w' : 'b';
+    *out++ = ' ';
 
     // Castle rights
-    uint8 castling = m_States[m_Ply].m_CastleRights;
-    if (castling & 0b1) {
-        FEN += "K";
-    }
-    if (castling & 0b10) {
-        FEN += "Q";
-    }
-    if (castling & 0b100) {
-        FEN += "k";
-    }
-    if (castling & 0b1000) {
-        FEN += "q";
-    }
-    if (!castling) {
-        FEN += '-';
+    const uint8 castling = m_States[m_Ply].m_CastleRights;
+    for (int right = 0; right < 4; right++) {
+        if (castling & (1 << right)) *out++ = "KQkq"[right];
     }
+    if (!castling) *out++ = '-';
 
-    FEN += ' ';
-    if (m_States[m_Ply].m_EnPassant > 0) {
-        char pos = 'h' - ((int)(log2(m_States[m_Ply].m_EnPassant)) % 8);
-        if (m_WhiteMove) {
-            FEN += pos + std::to_string(6);
-        } else {
-            FEN += pos + std::to_string(3);
-        }
+    *out++ = ' ';
+    if (m_States[m_Ply].m_EnPassant) {
+        *out++ = (char)('h' - GetSquare(m_States[m_Ply].m_EnPassant) % 8);
+        *out++ = m_WhiteMove ? '6' : '3';
     } else {
-        FEN += '-';
+        *out++ = '-';
     }
 
-    FEN += ' ' + std::to_string(m_States[m_Ply].m_HalfMoves);
-    FEN += ' ' + std::to_string(m_FullMoves);
-
-    return FEN;
+    *out++ = ' ';
+    out = std::to_chars(out, out + 3, m_States[m_Ply].m_HalfMoves).ptr;
+    *out++ = ' ';
+    out = std::to_chars(out, FEN + sizeof(FEN), m_FullMoves).ptr;
+    return std::string(FEN, out);
 }
 
 uint64 Zobrist_PawnHash(const Position& position) {
@@ -801,3 +1165,17 @@ uint64 Zobrist_PawnHash(const Position& position) {
 
     return result;
 }
+
+uint64 Zobrist_MaterialKey(const Position& position) {
+    uint64 result = 0;
+
+    for (int type = PAWN; type <= KING; type++) {
+        for (int color = 0; color < 2; color++) {
+            for (int i = CountBits(position.m_Pieces[type][color]) - 1; i >= 0; i--) {
+                result ^= MaterialZobrist(type, color, i);
+            }
+        }
+    }
+
+    return result;
+}
@@ -3,16 +3,57 @@
 #include "Move.h"
 #include "LookupTables.h"
 
+#include <memory>
+#include <string_view>
+#include <vector>
+
 #define CASTLE_WHITEKING  0b1
 #define CASTLE_WHITEQUEEN 0b10
 #define CASTLE_BLACKKING  0b100
 #define CASTLE_BLACKQUEEN 0b1000
 
+// Why SetPosition turned a FEN down, named after the field at fault
+enum FenError {
+    FEN_OK,
+    FEN_PLACEMENT, // Not eight ranks of eight squares, an unknown letter or a pawn on the first or last rank
+    FEN_KINGS,     // Not exactly one king a side
+    FEN_SIDE,
+    FEN_CASTLING,
+    FEN_EN_PASSANT, // Not on the third or sixth rank behind a pawn that just moved two squares
+    FEN_COUNTERS,
+};
+
+const char* FenErrorString(FenError error);
+
+// Everything UndoMove restores rather than recomputes
 struct IrreversibleState {
     uint8 m_CastleRights; // bitfield 0: WhiteKing, 1: WhiteQueen, 2: BlackKing, 3: BlackQueen
     uint8 m_HalfMoves;
+    uint8 m_PliesFromNull; // Plies since the last null move or the FEN, it stops counting at 255
+    bool m_InCheck;
     BitBoard m_EnPassant; // Todo: Maybe make this to position instead of bitboard to save bytes
     uint64 m_Hash;        // Stored here for the sake of counting repetition
+    uint64 m_PawnHash;
+    uint64 m_MaterialKey;
+};
+
+// What the side to move needs to tell whether a move gives check, filled in the first time a node asks
+struct CheckInfo {
+    BitBoard m_Squares[7]; // Per piece type, the squares from which it attacks the enemy king
+    BitBoard m_Blockers;   // Our pieces between one of our sliders and the enemy king
+    bool m_Valid;
+};
+
+// Plies a new history has room for. It doubles from there as the game and the search need.
+static constexpr size_t STATE_STACK_PLIES = 16;
+
+// The history under a Position, one entry per ply. It lives apart from the board so a copy of the board stays
+// small, and it grows with the game instead of stopping at a fixed length.
+struct StateStack {
+    std::vector<IrreversibleState> m_States;
+    std::vector<CheckInfo> m_CheckInfo;
+
+    explicit StateStack(size_t plies = STATE_STACK_PLIES) : m_States(plies), m_CheckInfo(plies) {}
 };
 
 class Position {
@@ -49,27 +90,87 @@ public:
     uint64 m_FullMoves;
 
     int m_Ply;
-    // Store irreversible variables
-    IrreversibleState m_States[512] = { 0 }; // TODO: Will yield a crash once we reach above 512 as max moves
+    // Store irreversible variables, indexed by m_Ply. Both point into m_Stack.
+    IrreversibleState* m_States;
+    mutable CheckInfo* m_CheckInfo; // Only valid once asked for
 
 
     // Hash values
     uint64 m_Hash; // TODO: Why do we have this when we already store it in m_States
     uint64 m_PawnHash;
+    uint64 m_MaterialKey; // Only the piece counts, what the tablebases are found by
 
     //
     bool m_InCheck;
 
-    Position() = default;
+    // Every position owns its history. A copy takes the plies played so far onto a history of its own, sized to
+    // the game, so either one can make moves without the other noticing.
+    Position();
+    Position(const Position& other);
+    Position(Position&& other) noexcept = default;
+    Position& operator=(const Position& other);
+    Position& operator=(Position&& other) noexcept = default;
 
-    void SetPosition(const std::string& FEN);
+    // Reads every field in one pass. The half and full move counters may be left out. A malformed FEN leaves the
+    // position as it was.
+    FenError SetPosition(std::string_view FEN);
 
     void MovePiece(Move move);
     void UndoMove(Move move);
 
+    // The same with the side making the move known at compile time, as it is throughout the search
+    template<Color white>
+    void TMovePiece(Move move);
+    template<Color white>
+    void TUndoMove(Move move);
+
     void NullMove();
     void UndoNullMove();
 
+    // Whether the move fits this position: our piece stands on the from square, the capture
+    // and flags agree with the board and nothing blocks the way. Pins and checks are left to
+    // IsLegal, so a move from the transposition table can be validated without generating.
+    bool IsPseudoLegal(Move move) const;
+
+    // Whether a pseudo legal move leaves our king out of check
+    bool IsLegal(Move move) const;
+
+    // Whether a legal move checks the enemy king, decided without making it
+    bool GivesCheck(Move move) const;
+
+    // Static exchange evaluation: whether the captures on the target square, each side taking with its least
+    // valuable piece and free to stop, win us at least threshold by ordering values. Castling and promotions
+    // count as even.
+    bool SeeGe(Move move, int threshold) const;
+
+    // The checking squares and discovered check candidates of the side to move
+    const CheckInfo& GetCheckInfo() const;
+
+    // The piece standing on a square, NOPIECE if it is empty
+    inline ColoredPieceType PieceOn(int sq) const {
+        const BitBoard bit = 1ull << sq;
+        if (!(m_Board & bit)) return NOPIECE;
+        const int color = (m_Black & bit) != 0;
+        for (int type = PAWN; type < KING; type++) {
+            if (m_Pieces[type][color] & bit) return ColoredPieceType(type + 6 * color);
+        }
+        return ColoredPieceType(KING + 6 * color);
+    }
+
+    // A stored move with its pieces taken from this position. Whether it is a move here at all is up to
+    // IsPseudoLegal.
+    inline Move UnpackMove(PackedMove packed) const {
+        if (packed == 0) return 0;
+        const ColoredPieceType type = PieceOn(packed & 0x3F);
+        const ColoredPieceType capture = EnPassant(::UnpackMove(packed)) ? (type == WPAWN ? BPAWN : WPAWN)
+                                                                        : PieceOn((packed >> 6) & 0x3F);
+        return ::UnpackMove(packed, type, capture);
+    }
+
+    // Whether the side to move can get back to a position of this search line with one reversible move, so it
+    // can hold a draw at least. ply is the distance from the root.
+    bool UpcomingRepetition(int ply) const;
+
     uint64 RookAttack(int pos, BitBoard occ) const;
     uint64 BishopAttack(int pos, BitBoard occ) const;
     uint64 QueenAttack(int pos, BitBoard occ) const;
@@ -77,16 +178,46 @@ public:
     BitBoard RookXray(int pos, BitBoard occ) const;
     BitBoard BishopXray(int pos, BitBoard occ) const;
 
+    // The same with the side to move fixed
+    template<Color white>
+    bool TIsPseudoLegal(Move move) const;
+
+    template<Color white>
+    bool TIsLegal(Move move) const;
+
+    template<Color white>
+    bool TGivesCheck(Move move) const;
+
+    template<Color white>
+    bool TSeeGe(Move move, int threshold) const;
+
+    template<Color white>
+    const CheckInfo& TGetCheckInfo() const;
+
     // Whether the side to move has anything but pawns
     inline constexpr bool HasNonPawnMaterial() const {
-        return m_WhiteMove ? (m_WhiteKnight | m_WhiteBishop | m_WhiteRook | m_WhiteQueen) != 0
-                           : (m_BlackKnight | m_BlackBishop | m_BlackRook | m_BlackQueen) != 0;
+        return m_WhiteMove ? THasNonPawnMaterial<WHITE>() : THasNonPawnMaterial<BLACK>();
+    }
+
+    template<Color white>
+    inline constexpr bool THasNonPawnMaterial() const {
+        return (Knight<white>() | Bishop<white>() | Rook<white>() | Queen<white>()) != 0;
     }
 
     std::string ToFen() const;
 
 private:
-    void SetState(const std::string& FEN);
+    std::unique_ptr<StateStack> m_Stack;
+
+    // Makes room for one more ply
+    inline void Reserve() {
+        if (m_Ply + 1 >= (int)m_Stack->m_States.size()) Grow();
+    }
+    void Grow();
+
+    // Whether the enemy attacks sq when the board is occ and the pieces in removed are captured
+    template<Color white>
+    bool Attacked(int sq, BitBoard occ, BitBoard removed) const;
 
     template<Color white>
     bool UpdateChecks() const {
@@ -179,4 +310,11 @@ private:
 };
 
 uint64 Zobrist_Hash(const Position& position);
-uint64 Zobrist_PawnHash(const Position& position);
\ No newline at end of file
+uint64 Zobrist_PawnHash(const Position& position);
+uint64 Zobrist_MaterialKey(const Position& position);
+
+// A material key holds one key per piece, for the index-th piece of its type and color counting from zero. So a
+// capture or a promotion changes it by the key of the piece count it leaves behind.
+static inline uint64 MaterialZobrist(int type, int color, int index) {
+    return Lookup::zobrist[(type - 1) * 128 + color * 64 + index];
+}
\ No newline at end of file
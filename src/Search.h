@@ -20,19 +20,60 @@
 #define MAX_BETA        int64(32767)
 #define DEFAULT_HASH_MB 16ull
 #define PAWN_TABLE_MB   1ull
+#define MAX_MULTIPV     256
+#define PONDERHIT_PENDING int64(-1)
+
+static_assert(MAX_DEPTH <= MOVE_LIST_PLIES, "MoveGen has no room for lists that deep");
+
+// Shallow pruning, margins in centipawns. All in one place for tuning.
+static constexpr int RFP_DEPTH = 6;       // Reverse futility: static eval beats beta by a margin a ply
+static constexpr int RFP_MARGIN = 150;
+static constexpr int FUTILITY_DEPTH = 4;  // Futility: a quiet move would need more than the margin to reach alpha,
+static constexpr int FUTILITY_BASE = 150; // a ply more of it when improving
+static constexpr int FUTILITY_MARGIN = 150;
+static constexpr int PROBCUT_DEPTH = 5;   // ProbCut: a capture holds beta plus the margin at depth - 4
+static constexpr int PROBCUT_MARGIN = 200;
+static constexpr int IIR_DEPTH = 4;       // Internal iterative reduction: nodes with no hash move lose a ply, PV
+static constexpr int IIR_PV_DEPTH = 6;    // nodes further from the horizon
+static constexpr int QS_DELTA = 200;      // Quiescence delta pruning: what a capture may win beyond its victim
 
-// Quadratic https://www.chessprogramming.org/Triangular_PV-Table
 struct MoveStack {
-    Move m_PV[MAX_DEPTH] = {};
     int m_Ply = 0;
     int m_Eval = NONE_SCORE;
     Move m_CurrentMove = 0; // 0 also marks a null move, so the child won't null move again
 };
 
+// https://www.chessprogramming.org/Triangular_PV-Table
+// The line from each ply of the current path. A line from ply p holds at most MAX_DEPTH - p moves, so the rows
+// shrink as they go and are packed one after the other.
+struct PVTable {
+    PackedMove m_Moves[MAX_DEPTH * (MAX_DEPTH + 1) / 2];
+    int m_Length[MAX_DEPTH + 1] = {};
+
+    PackedMove* Line(int ply) { return m_Moves + ply * MAX_DEPTH - ply * (ply - 1) / 2; }
+
+    void Clear(int ply) { m_Length[ply] = 0; }
+
+    // The move followed by the line found below it
+    void Update(int ply, Move move) {
+        PackedMove* line = Line(ply);
+        line[0] = PackMove(move);
+        std::copy_n(Line(ply + 1), m_Length[ply + 1], line + 1);
+        m_Length[ply] = m_Length[ply + 1] + 1;
+    }
+};
+
+// A move at the root with the line found below it. Only the best of a search and the moves that raised alpha get a
+// score, the rest drop to -MATE_SCORE and are ordered by the nodes it took to refute them: a move that was hard to
+// refute is the likeliest to be the next best.
 struct RootMove {
-    int score;
-    Move move;
-    bool operator<(const RootMove& m) const { return m.score < score; }
+    Move move = 0;
+    int64 score = -MATE_SCORE;
+    int64 previousScore = -MATE_SCORE; // From the last depth, the aspiration window of the line is set around it
+    uint64 nodes = 0;                  // Spent below the move in the last search of it
+    std::vector<PackedMove> pv;
+    bool operator<(const RootMove& m) const { return m.score != score ? m.score < score : m.nodes < nodes; }
+    bool operator==(Move m) const { return move == m; }
 };
 
 enum NodeType { ROOT, PV, NON_PV };
@@ -41,15 +82,44 @@ struct SearchLimits {
     int maxDepth = MAX_DEPTH;
     uint64 maxNodes = 0;  // 0 = unlimited
     int64 maxTimeMs = -1; // -1 = unlimited
+    // The time a timed game would like to spend. Scaled after each iteration, half of it is the soft limit no new
+    // iteration starts past and all of it the hard limit, though never more than maxTimeMs. -1 = a fixed maxTimeMs.
+    int64 optimumTimeMs = -1;
+    // Time is counted in nodes at this rate, so a timed search walks the same tree however loaded the machine is.
+    // 0 = the wall clock.
+    int64 nodesPerMs = 0;
+    int mate = 0;                  // Stop once we mate in at most this many moves, 0 = search on past any mate
+    std::vector<Move> searchMoves; // The root moves to choose from, empty = all of them
     bool useTablebase = true;
     bool silent = false; // Skip the per depth info lines, for searches nobody is watching
 };
 
+// How much of the optimum time the search deserves, measured after each iteration. More while the best move keeps
+// changing or the score falls, less when the best move takes nearly all of the nodes.
+struct TimeManager {
+    double m_Changes = 0; // A change of best move counts half as much an iteration later
+    int64 m_LastScore = NONE_SCORE;
+    Move m_LastBest = 0;
+
+    double Scale(Move best, int64 score, uint64 bestNodes, uint64 nodes) {
+        m_Changes = m_Changes / 2 + (m_LastBest != 0 && best != m_LastBest);
+        const double falling =
+            m_LastScore == NONE_SCORE ? 1.0 : std::clamp(1.0 + (m_LastScore - score) / 200.0, 0.75, 1.5);
+        const double effort = nodes ? (double)bestNodes / nodes : 0.5;
+        m_LastBest = best;
+        m_LastScore = score;
+        return std::clamp((1.0 + m_Changes) * falling * (1.5 - effort), 0.4, 3.0);
+    }
+};
+
 struct SearchResult {
     Move best = 0;
+    Move ponder = 0; // The reply we expect, 0 if none is known
     int64 score = 0;
     uint64 nodes = 0;
+    uint64 qnodes = 0; // Of the nodes, the ones in quiescence
     int depth = 0;
+    std::vector<RootMove> lines; // The MultiPV best root moves, best first
 };
 
 class Search {
@@ -66,16 +136,41 @@ private:
     Timer m_Timer;
     int m_Maxdepth; // Maximum depth currently set
     uint64 m_NodeCnt;
+    uint64 m_QNodeCnt; // The part of m_NodeCnt spent in quiescence
     std::unique_ptr<TranspositionTable> m_Table;
     std::unique_ptr<PawnTable> m_PawnTable;
+    std::unique_ptr<MoveStack[]> m_Stack; // The plies, kept from one search to the next
+    PVTable m_PV;
     std::vector<RootMove> m_RootMoves;
+    int m_MultiPV = 1; // Lines searched, each without the best moves of the lines before it
+    int m_PVIdx = 0;   // The line being searched, the root moves ahead of it are excluded
     int m_RootDelta;
+
+    // While pondering the search runs on the opponent's time and no time limit counts. On ponderhit the clock starts
+    // and the watchdog, or the node limit when time runs in nodes, gets the hard limit the search has come to by then.
+    Watchdog m_Watchdog;
+    std::mutex m_PonderMutex;
+    std::condition_variable m_PonderDone; // Wakes a search that finished while pondering, on ponderhit or stop
+    std::atomic<bool> m_Pondering;
+    std::atomic<int64> m_PonderHitMs; // Since the search started, 0 if it never pondered
+    int64 m_HardMs;
+    std::atomic<uint64> m_NodeLimit; // Checked at every node: go nodes, and the hard limit when time runs in nodes
+
+    // The nodestime option. The GUI's clock keeps wall time, so a timed game keeps its own clock in nodes, charged
+    // with the nodes of each search and credited with the increment.
+    int64 m_NodesTime = 0;
+    int64 m_NodesLeft = 0; // 0 until the first timed search of a game
+    int64 m_NodesIncrement = 0;
+
     SearchLimits m_Limits;
 
 public:
-    Search(uint64 hashMB = DEFAULT_HASH_MB) : m_Maxdepth(0), m_Running(false), m_Stopping(false), m_NodeCnt(0) {
+    Search(uint64 hashMB = DEFAULT_HASH_MB) : m_Maxdepth(0), m_Running(false), m_Stopping(false), m_NodeCnt(0),
+          m_QNodeCnt(0), m_Pondering(false), m_PonderHitMs(0), m_HardMs(-1),
+          m_NodeLimit(UINT64_MAX) {
         m_Table = std::make_unique<TranspositionTable>(hashMB * 1024 * 1024);
         m_PawnTable = std::make_unique<PawnTable>(PAWN_TABLE_MB * 1024 * 1024);
+        m_Stack = std::make_unique<MoveStack[]>(MAX_DEPTH);
         LoadPosition(Lookup::starting_pos);
     }
 
@@ -86,6 +181,8 @@ public:
         m_Table->Resize(hashMB * 1024 * 1024);
     }
 
+    void SetMultiPV(int lines) { m_MultiPV = std::max(lines, 1); }
+
     void JoinThreads() {
         for (std::unique_ptr<std::thread>& t : m_Threads) {
             if (t->joinable()) {
@@ -98,16 +195,66 @@ public:
     void Stop() {
         m_Stopping = true; // A search that has not entered Go() yet would miss m_Running
         m_Running = false;
+        {
+            // Taken so a ponder search about to wait either sees m_Running or gets the notify
+            std::lock_guard<std::mutex> lock(m_PonderMutex);
+        }
+        m_PonderDone.notify_all();
         JoinThreads();
         m_Stopping = false;
     }
 
-    bool TimeExpired() { return m_Limits.maxTimeMs >= 0 && m_Timer.EndMs() >= m_Limits.maxTimeMs; }
+    bool IsSearching() const { return m_Running; }
 
+    void SetNodesTime(int64 nodesPerMs) {
+        m_NodesTime = std::max<int64>(nodesPerMs, 0);
+        m_NodesLeft = 0;
+    }
+
+    int64 NodesTime() const { return m_NodesTime; }
+
+    // Milliseconds since the search started, or the nodes searched turned into them when time runs in nodes
+    int64 Now() { return m_Limits.nodesPerMs > 0 ? m_NodeCnt / m_Limits.nodesPerMs : m_Timer.EndMs(); }
+
+    // On our own clock, which starts late when pondering
+    int64 Elapsed() { return Now() - m_PonderHitMs; }
+
+    uint64 NodeBudget() const { return m_Limits.maxNodes ? m_Limits.maxNodes : UINT64_MAX; }
+
+    // The hard limit, counted from the start of the search. Called with m_PonderMutex held.
+    void SetHardLimit(int64 ms) {
+        if (m_Limits.maxTimeMs < 0) return;
+        if (m_Limits.nodesPerMs > 0) m_NodeLimit = std::min<uint64>(NodeBudget(), ms * m_Limits.nodesPerMs);
+        else m_Watchdog.SetDeadline(ms);
+    }
+
+    // Only the search knows its node count, so with time in nodes a ponderhit is timed at the next node or
+    // iteration the search comes to. Called with m_PonderMutex held.
+    void TakePonderHit() {
+        if (m_PonderHitMs != PONDERHIT_PENDING) return;
+        m_PonderHitMs = Now();
+        m_NodeLimit = NodeBudget();
+        SetHardLimit(m_PonderHitMs + m_HardMs);
+    }
+
+    // The node limit was reached, or a ponderhit pulled it down to have the search start its clock
+    bool NodeLimitReached() {
+        std::lock_guard<std::mutex> lock(m_PonderMutex);
+        if (m_PonderHitMs != PONDERHIT_PENDING) return true;
+        TakePonderHit();
+        return m_NodeCnt >= m_NodeLimit;
+    }
+
+    // Checked at every node, so it reads no clock. The time limit is kept by a watchdog that clears m_Running, or by
+    // the node limit when time runs in nodes.
     bool ShouldStop() {
         if (!m_Running || m_Stopping) return true;
-        if (m_Limits.maxNodes && m_NodeCnt >= m_Limits.maxNodes) return true;
-        return TimeExpired();
+        return m_NodeCnt >= m_NodeLimit.load(std::memory_order_relaxed) && NodeLimitReached();
+    }
+
+    void NewGame() {
+        ClearTables();
+        m_NodesLeft = 0;
     }
 
     void ClearTables() {
@@ -115,21 +262,23 @@ public:
         m_PawnTable->Clear();
     }
 
-    void LoadPosition(std::string fen) { m_Position.SetPosition(fen); }
-
-    static void Update_PV(Move* pv, Move move, Move* target) {
-        for (*pv++ = move; target && *target != Move();) *pv++ = *target++;
-        *pv = Move();
-    }
+    FenError LoadPosition(std::string_view fen) { return m_Position.SetPosition(fen); }
 
-    template<NodeType node>
+    // White is the side to move, so every node is compiled for one side and passes the other to its children
+    template<NodeType node, Color white>
     int64 Quiesce(Position& board, MoveStack* stack, int64 alpha, int64 beta, int depth) {
         constexpr bool PVNode = node != NON_PV;
 
         // Quiescence does not build a PV, so the line ends here.
-        if (PVNode) stack->m_PV[0] = Move();
+        if (PVNode) m_PV.Clear(stack->m_Ply);
 
+        // Counted after the check, so a node limit is hit exactly
+        if (ShouldStop()) return 0;
         m_NodeCnt++;
+        m_QNodeCnt++;
+
+        // Out of plies, see AlphaBeta
+        if (stack->m_Ply >= MAX_DEPTH - 1) return TEvaluate<white>(board, m_PawnTable.get());
 
         // Check for repetition
         for (int i = 4; i < board.m_States[board.m_Ply].m_HalfMoves && i < board.m_Ply; i += 2) {
@@ -138,8 +287,16 @@ public:
             }
         }
 
+        // If we can repeat, we can score at least a draw
+        if (alpha < 0 && board.UpcomingRepetition(stack->m_Ply)) {
+            alpha = 0;
+            if (alpha >= beta) return alpha;
+        }
+
         // Probe Transposition table
         Move hashMove = Move();
+        int64 ttScore = NONE_SCORE;
+        Bound ttBound = NO_BOUND;
         bool ttPV = PVNode;
         TTEntry* entry = m_Table->Probe(board.m_Hash);
         if (entry != nullptr) {
@@ -147,31 +304,59 @@ public:
                 && (entry->m_Bound & (entry->m_Score >= beta ? LOWER_BOUND : UPPER_BOUND))) {
                 return entry->m_Score;
             }
-            hashMove = entry->m_BestMove;
+            hashMove = board.UnpackMove(entry->m_BestMove);
+            ttScore = entry->m_Score;
+            ttBound = entry->m_Bound;
             ttPV |= entry->m_PV;
         }
 
-        int64 bestScore = Evaluate(board, m_PawnTable.get());
+        // The first ply also tries quiet checks. In check on the first two plies every evasion is searched instead
+        // of standing pat, or a check there would prove nothing.
+        const bool checks = depth == 0 && !board.m_InCheck;
+        const bool evade = depth >= -1 && board.m_InCheck;
+
+        int64 bestScore = TEvaluate<white>(board, m_PawnTable.get());
         stack->m_Eval = bestScore;
-        if (bestScore >= beta) { // Return if we fail soft
-            return bestScore;
-        }
-        if (alpha < bestScore) {
-            alpha = bestScore;
+        if (evade) {
+            bestScore = -MATE_SCORE + stack->m_Ply;
+        } else {
+            // A stored score is a search, so where its bound points past the eval it stands pat in its place
+            if (ttScore != NONE_SCORE && (ttBound & (ttScore > bestScore ? LOWER_BOUND : UPPER_BOUND))) {
+                bestScore = ttScore;
+            }
+            if (bestScore >= beta) { // Return if we fail soft
+                return bestScore;
+            }
+            if (alpha < bestScore) {
+                alpha = bestScore;
+            }
         }
+        const int64 standPat = bestScore;
 
         Move bestMove = 0;
         int movecnt = 0;
 
-        MoveGen moveGen(board, hashMove, true);
+        // In check MoveGen generates evasions, so the move count tells mate apart
+        MoveGen moveGen(board, hashMove, true, checks);
         Move move;
-        while ((move = moveGen.Next()) != 0) {
+        while ((move = moveGen.TNext<white>()) != 0) {
             movecnt++;
-            if (CaptureType(move) == ColoredPieceType::NOPIECE) continue; // Only analyze capturing moves
+            // Only analyze capturing moves, and the quiet checks or evasions of the first plies
+            if (CaptureType(move) == ColoredPieceType::NOPIECE && !evade && !moveGen.QuietCheck()) continue;
+
+            // Not while in check or with nothing but a mate to show yet, where a pruned move may be the only way out
+            if (!board.m_InCheck && bestScore > -MATE_SCORE + MAX_DEPTH && CaptureType(move) != NOPIECE) {
+                // Delta pruning. Even winning the piece for free leaves us short of alpha
+                if (!Promotion(move) && standPat + OrderingPieceValue(CaptureType(move)) + QS_DELTA <= alpha) {
+                    continue;
+                }
+                // Nor is a capture that loses material once the exchange is played out
+                if (!board.TSeeGe<white>(move, 0)) continue;
+            }
 
-            board.MovePiece(move);
-            int64 score = -Quiesce<node>(board, stack + 1, -beta, -alpha, depth - 1);
-            board.UndoMove(move);
+            board.TMovePiece<white>(move);
+            int64 score = -Quiesce<node, !white>(board, stack + 1, -beta, -alpha, depth - 1);
+            board.TUndoMove<white>(move);
             if (score > bestScore) {
                 bestScore = score;
                 bestMove = move;
@@ -184,18 +369,8 @@ public:
             }
         }
 
-        // Check for mate or stalemate
-        if (!movecnt) {
-            if (board.m_InCheck) {
-                std::vector<Move> mate = GenerateMoves<ALL>(
-                    board); // TODO: Generate evasions in Quiescense which will give mate or draw if movecnt == 0
-                if (mate.size() == 0) bestScore = -MATE_SCORE + stack->m_Ply;
-            } else { // Commented out because it yields better performance without it even though it may not be correct
-                //std::vector<Move> mate = GenerateMoves<ALL>(board);
-                //if (mate.size() == 0) bestScore = 0;
-            }
-        }
-
+        // Capture generation can not tell stalemate apart, and it is rare enough not to pay for
+        if (!movecnt && board.m_InCheck) bestScore = -MATE_SCORE + stack->m_Ply;
 
         m_Table->Enter(board.m_Hash, TTEntry(board.m_Hash, bestMove, bestScore,
                                              bestScore >= beta ? LOWER_BOUND
@@ -207,7 +382,7 @@ public:
         return bestScore;
     }
 
-    template<NodeType node>
+    template<NodeType node, Color white>
     int64 AlphaBeta(Position& board, MoveStack* stack, int alpha, int beta, int depth, bool cutNode,
                     Move excluded = 0) {
         constexpr bool PVNode = node != NON_PV;
@@ -215,28 +390,34 @@ public:
 
         // The parent copies this PV once the node returns, so it must not still
         // hold a line from an unrelated subtree.
-        if (PVNode) stack->m_PV[0] = Move();
+        if (PVNode) m_PV.Clear(stack->m_Ply);
 
-        m_NodeCnt++;
         if (ShouldStop()) return 0;
+        m_NodeCnt++;
 
         // Quiesce search if we reached the bottom
         if (depth <= 0) {
-            return Quiesce<node>(board, stack, alpha, beta, depth);
+            return Quiesce<node, white>(board, stack, alpha, beta, 0);
         }
 
         if (!rootNode) {
             // We count any repetion as draw
-            // TODO: Maybe employ hashing to make this O(1) instead of O(n)
             for (int i = 4; i < board.m_States[board.m_Ply].m_HalfMoves && i < board.m_Ply; i += 2) {
                 if (board.m_States[board.m_Ply - i].m_Hash == board.m_Hash) {
                     return 0;
                 }
             }
+
+            // If we can repeat, we can score at least a draw. A cuckoo table of reversible moves finds it in
+            // constant time per earlier position, a cycle away before the repetition is on the board.
+            if (alpha < 0 && board.UpcomingRepetition(stack->m_Ply)) {
+                alpha = 0;
+                if (alpha >= beta) return alpha;
+            }
         }
 
-        // Prevent explosions
-        assert(stack->m_Ply < MAX_DEPTH && "Ply is more than MAX_DEPTH!");
+        // Prevent explosions. The ply stack and the move lists end at MAX_DEPTH, so a line that long stops here
+        if (stack->m_Ply >= MAX_DEPTH - 1) return TEvaluate<white>(board, m_PawnTable.get());
         depth = std::min(depth, MAX_DEPTH - 1);
 
 
@@ -253,7 +434,7 @@ public:
                 && (entry->m_Bound & (entry->m_Score >= beta ? LOWER_BOUND : UPPER_BOUND))) {
                 return entry->m_Score;
             }
-            hashMove = entry->m_BestMove;
+            hashMove = board.UnpackMove(entry->m_BestMove);
             ttScore = entry->m_Score;
             ttDepth = entry->m_Depth;
             ttBound = entry->m_Bound;
@@ -261,7 +442,7 @@ public:
         }
 
         // Probe the tablebase. It scores the position, which excluding a move does not change
-        if (!rootNode && excluded == 0 && m_Limits.useTablebase) {
+        if (!rootNode && excluded == 0 && m_Limits.useTablebase && CountBits(board.m_Board) <= TableBase::MaxPieces()) {
             int success;
             //printf("%s\n", board.ToFen().c_str());
             int v = TableBase::Probe_DTZ(board, &success);
@@ -280,14 +461,24 @@ public:
             }
         }
 
-        int64 staticEval = Evaluate(board, m_PawnTable.get());
+        int64 staticEval = TEvaluate<white>(board, m_PawnTable.get());
         stack->m_Eval = staticEval;
         bool improving = false;
 
-        if (!board.m_InCheck && stack->m_Ply >= 2) {
-            improving = stack->m_Eval > (stack - 2)->m_Eval;
-        } else if (stack->m_Ply >= 4) {
-            improving = stack->m_Eval > (stack - 4)->m_Eval;
+        // Nothing comes before the root, and once the root is inlined the compiler would look there otherwise
+        if constexpr (!rootNode) {
+            if (!board.m_InCheck && stack->m_Ply >= 2) {
+                improving = stack->m_Eval > (stack - 2)->m_Eval;
+            } else if (stack->m_Ply >= 4) {
+                improving = stack->m_Eval > (stack - 4)->m_Eval;
+            }
+        }
+
+        // Reverse futility pruning. So far above beta that no move of ours should lose it all. Improving does not
+        // lower the margin: at depth 1 that leaves none, and a threat the static eval can not see goes unanswered.
+        if (!PVNode && !board.m_InCheck && excluded == 0 && depth <= RFP_DEPTH
+            && staticEval - RFP_MARGIN * depth >= beta && staticEval < MATE_SCORE - MAX_DEPTH) {
+            return staticEval;
         }
 
         // Null move pruning
@@ -295,12 +486,13 @@ public:
         // which we signal by leaving its m_CurrentMove at 0. Passing is also a bad idea in
         // zugzwang, so require a piece on the board.
         if (!PVNode && !board.m_InCheck && excluded == 0 && stack->m_Ply >= 1 && (stack - 1)->m_CurrentMove != 0
-            && stack->m_Eval >= beta && stack->m_Eval + 40 * depth - 200 >= beta && board.HasNonPawnMaterial()) {
+            && stack->m_Eval >= beta && stack->m_Eval + 40 * depth - 200 >= beta
+            && board.THasNonPawnMaterial<white>()) {
             // The margin is in centipawns, so scale it before spending it as plies
             int reduction = (int)std::min<int64>((stack->m_Eval - beta) / 200, 6) + depth / 3 + 4;
             stack->m_CurrentMove = 0;
             board.NullMove();
-            int nullscore = -AlphaBeta<NON_PV>(board, stack + 1, -beta, -beta + 1, depth - reduction, !cutNode);
+            int nullscore = -AlphaBeta<NON_PV, !white>(board, stack + 1, -beta, -beta + 1, depth - reduction, !cutNode);
             board.UndoNullMove();
             if (nullscore >= beta) {
                 // A mate found by passing a move is not a real mate
@@ -308,6 +500,43 @@ public:
             }
         }
 
+        // Internal iterative reduction. With no hash move the moves come unordered, so a node we expect to matter
+        // is searched a ply shallower, and the move it finds orders the next iteration. Close to the horizon a PV
+        // node keeps its depth, or the quiet move pruning below can lose a winning pawn push off the PV.
+        if (!rootNode && (PVNode || cutNode) && excluded == 0 && hashMove == 0
+            && depth >= (PVNode ? IIR_PV_DEPTH : IIR_DEPTH)) {
+            depth--;
+        }
+
+        // ProbCut. At an expected cut node a capture that still beats beta by a margin in a shallow search will
+        // most likely beat beta in the full one. The hash entry can tell us not to bother.
+        const int64 probCutBeta = beta + PROBCUT_MARGIN;
+        if (cutNode && !board.m_InCheck && excluded == 0 && depth >= PROBCUT_DEPTH
+            && beta > -MATE_SCORE + MAX_DEPTH && probCutBeta < MATE_SCORE - MAX_DEPTH
+            && !(ttDepth >= depth - 3 && ttScore != NONE_SCORE && ttScore < probCutBeta)) {
+            MoveGen probCutGen(board, hashMove, true);
+            Move move;
+            while ((move = probCutGen.TNext<white>()) != 0) {
+                if (!board.TSeeGe<white>(move, (int)(probCutBeta - staticEval))) continue;
+
+                stack->m_CurrentMove = move;
+                board.TMovePiece<white>(move);
+                // A quiescence search first weeds out most of them for less
+                int64 score = -Quiesce<NON_PV, !white>(board, stack + 1, -probCutBeta, -probCutBeta + 1, 0);
+                if (score >= probCutBeta) {
+                    score = -AlphaBeta<NON_PV, !white>(board, stack + 1, -probCutBeta, -probCutBeta + 1, depth - 4,
+                                                      !cutNode);
+                }
+                board.TUndoMove<white>(move);
+
+                if (score >= probCutBeta) {
+                    m_Table->Enter(board.m_Hash, TTEntry(board.m_Hash, move, score, LOWER_BOUND, stack->m_Ply,
+                                                         depth - 3, board.m_FullMoves, ttPV));
+                    return score;
+                }
+            }
+        }
+
         int64 bestScore = -MATE_SCORE;
         int64 old_alpha = alpha;
         Move bestMove = 0;
@@ -316,16 +545,32 @@ public:
 
         int movecnt = 0;
 
+        // The root walks its own list, kept in order from one depth to the next. The lines of a MultiPV search before
+        // this one hold the moves ahead of m_PVIdx.
         MoveGen moveGen(board, hashMove, false);
+        size_t rootIdx = m_PVIdx;
         Move move;
-        while ((move = moveGen.Next()) != 0) {
+        while ((move = rootNode ? (rootIdx < m_RootMoves.size() ? m_RootMoves[rootIdx++].move : 0)
+                                : moveGen.TNext<white>())
+               != 0) {
             if (move == excluded) continue;
+            bool capture = CaptureType(move) != NOPIECE;
+            bool givesCheck = board.TGivesCheck<white>(move);
+
+            // Futility pruning of quiet moves, once a move has saved us from being mated. A pruned move is not
+            // counted, movecnt is the moves searched so far.
+            if (!rootNode && depth <= FUTILITY_DEPTH && !capture && !Promotion(move) && !givesCheck
+                && !board.m_InCheck && bestScore > -MATE_SCORE + MAX_DEPTH
+                && staticEval + FUTILITY_BASE + FUTILITY_MARGIN * (depth + improving) <= alpha) {
+                continue;
+            }
+
             movecnt++;
             stack->m_CurrentMove = move;
+            const uint64 nodesBefore = m_NodeCnt;
             int newDepth = depth - 1;
             int reduction = 0, extension = 0;
             int delta = beta - alpha;
-            bool capture = CaptureType(move) != NOPIECE;
             // Singular extension. Re-searches this node without the hash move, so it runs before the
             // move is made and is not negated: the score is ours, not the opponent's reply.
             if (!rootNode && excluded == 0 && stack->m_Ply < 2 * m_Maxdepth && depth >= 6 && move == hashMove
@@ -335,8 +580,8 @@ public:
                 // The child reuses this ply's stack slot
                 int64 savedEval = stack->m_Eval;
                 Move savedMove = stack->m_CurrentMove;
-                int64 singularScore =
-                    AlphaBeta<NON_PV>(board, stack, singularBeta - 1, singularBeta, (depth - 1) / 2, cutNode, move);
+                int64 singularScore = AlphaBeta<NON_PV, white>(board, stack, singularBeta - 1, singularBeta,
+                                                               (depth - 1) / 2, cutNode, move);
                 stack->m_Eval = savedEval;
                 stack->m_CurrentMove = savedMove;
 
@@ -351,7 +596,7 @@ public:
                 }
             }
 
-            board.MovePiece(move);
+            board.TMovePiece<white>(move);
 
             newDepth += extension;
 
@@ -360,7 +605,7 @@ public:
                 //reduction = ((375 + 220 * std::log(depth) * std::log(movecnt)) / (1 + capture)) / 1000;
                 reduction = ((500 + 400 * std::log(depth) * std::log(movecnt)) / (1 + capture)) / 1000;
                 // Extend checks
-                if (board.m_InCheck && stack->m_Ply < MAX_DEPTH) reduction -= 1;
+                if (givesCheck && stack->m_Ply < MAX_DEPTH) reduction -= 1;
 
                 // If we are on pv node then decrease reduction
                 if (PVNode) reduction -= 1;
@@ -378,29 +623,41 @@ public:
                 if (cutNode) reduction += 1;
 
                 int reducedDepth = std::min(std::max(1, newDepth - reduction), newDepth + 1);
-                score = -AlphaBeta<NON_PV>(board, stack + 1, -alpha - 1, -alpha, reducedDepth, true);
+                score = -AlphaBeta<NON_PV, !white>(board, stack + 1, -alpha - 1, -alpha, reducedDepth, true);
                 if (score > alpha && reducedDepth < newDepth) {
                     // newdepth is different so search it again att full depth
                     if (reducedDepth < newDepth) {
-                        score = -AlphaBeta<NON_PV>(board, stack + 1, -alpha - 1, -alpha, newDepth, !cutNode);
+                        score = -AlphaBeta<NON_PV, !white>(board, stack + 1, -alpha - 1, -alpha, newDepth, !cutNode);
                     }
                 }
             } else if (!PVNode || movecnt > 1) {
-                score = -AlphaBeta<NON_PV>(board, stack + 1, -alpha - 1, -alpha, newDepth, !cutNode);
+                score = -AlphaBeta<NON_PV, !white>(board, stack + 1, -alpha - 1, -alpha, newDepth, !cutNode);
             }
 
             if (PVNode && (movecnt == 1 || score > alpha)) {
-                score = -AlphaBeta<PV>(board, stack + 1, -beta, -alpha, newDepth, false);
+                score = -AlphaBeta<PV, !white>(board, stack + 1, -beta, -alpha, newDepth, false);
             }
 
 
-            board.UndoMove(move);
+            board.TUndoMove<white>(move);
+            if constexpr (rootNode) {
+                RootMove& rootMove = m_RootMoves[rootIdx - 1];
+                rootMove.nodes = m_NodeCnt - nodesBefore;
+                if (movecnt == 1 || score > alpha) {
+                    rootMove.score = score;
+                    rootMove.pv.assign(1, PackMove(move));
+                    const int ply = stack->m_Ply + 1;
+                    rootMove.pv.insert(rootMove.pv.end(), m_PV.Line(ply), m_PV.Line(ply) + m_PV.m_Length[ply]);
+                } else {
+                    rootMove.score = -MATE_SCORE;
+                }
+            }
             if (score > bestScore) {
                 bestScore = score;
                 bestMove = move;
                 if (score > alpha) {
                     if (PVNode) {
-                        Update_PV(stack->m_PV, bestMove, (stack + 1)->m_PV);
+                        m_PV.Update(stack->m_Ply, bestMove);
                     }
                     alpha = score;
                 }
@@ -421,7 +678,8 @@ public:
             }
         }
 
-        if (excluded == 0) {
+        // A later MultiPV line has its best moves taken away, the root entry keeps the real best
+        if (excluded == 0 && !(rootNode && m_PVIdx > 0)) {
             m_Table->Enter(board.m_Hash, TTEntry(board.m_Hash, bestMove, bestScore,
                                                  bestScore >= beta ? LOWER_BOUND
                                                  : PVNode          ? EXACT_BOUND
@@ -433,15 +691,23 @@ public:
     }
 
 
-    // Calculate time to allocate for a move
-    void MoveTimed(int64 wtime, int64 btime, int64 winc, int64 binc, int depth = MAX_DEPTH) {
+    // Calculate time to allocate for a move, on top of the other limits. movestogo is the moves left until the clock
+    // is refilled, 0 for sudden death where we guess at the length of the game.
+    void MoveTimed(SearchLimits limits, int64 wtime, int64 btime, int64 winc, int64 binc, int movestogo = 0,
+                   bool ponder = false) {
         int64 timediff = llabs(wtime - btime);
 
         bool moreTime = m_Position.m_WhiteMove ? wtime > btime : wtime < btime;
         int64 timeleft = m_Position.m_WhiteMove ? wtime : btime;
         int64 timeinc = m_Position.m_WhiteMove ? winc : binc;
+        if (m_NodesTime > 0) {
+            if (m_NodesLeft == 0) m_NodesLeft = timeleft * m_NodesTime;
+            timeleft = m_NodesLeft / m_NodesTime;
+            m_NodesIncrement = timeinc * m_NodesTime;
+            limits.nodesPerMs = m_NodesTime;
+        }
 
-        int64 est_movesleft = std::max(60 - (int64)m_Position.m_FullMoves, int64(20));
+        int64 est_movesleft = movestogo > 0 ? movestogo : std::max(60 - (int64)m_Position.m_FullMoves, int64(20));
         int64 est_timeleft = timeleft + est_movesleft * timeinc;
 
         int64 target = std::max(std::min(est_timeleft / est_movesleft - 20, timeleft / 2),
@@ -450,131 +716,248 @@ public:
         float factor = 0.5 + 0.5 * exp(-x * x); // const + Bell curve, bounded [0.5,1]
         int64 result = (target * factor);
         sync_printf("info movetime %" PRId64 "\n", result);
-        UCIMove(result, depth);
-    }
 
-    void UCIMove(int64 time, int depth = MAX_DEPTH) {
-        SearchLimits limits;
-        limits.maxTimeMs = time;
-        limits.maxDepth = std::clamp(depth, 1, (int)MAX_DEPTH);
-        StartAsync(limits);
+        // An unsettled search may take up to three times as long, but never more than a third of the clock
+        limits.optimumTimeMs = result;
+        limits.maxTimeMs = std::clamp(timeleft / 3, result, 3 * result);
+        StartAsync(limits, ponder);
     }
 
-    void StartAsync(const SearchLimits& limits) {
+    // A ponder search keeps going, and holds back its bestmove, until PonderHit or Stop
+    void StartAsync(const SearchLimits& limits, bool ponder = false) {
         JoinThreads();
         m_Limits = limits;
+        m_Pondering = ponder;
         m_Threads.push_back(std::make_unique<std::thread>(&Search::UCIMove_async, &*this));
     }
 
+    // The opponent played the move we pondered on, the search goes on as a timed one from here
+    void PonderHit() {
+        {
+            std::lock_guard<std::mutex> lock(m_PonderMutex);
+            if (!m_Pondering) return;
+            m_Pondering = false;
+            if (m_Limits.nodesPerMs > 0) {
+                m_PonderHitMs = PONDERHIT_PENDING;
+                m_NodeLimit = 0;
+            } else {
+                m_PonderHitMs = m_Timer.EndMs();
+                SetHardLimit(m_PonderHitMs + m_HardMs);
+            }
+        }
+        m_PonderDone.notify_all();
+    }
+
     void UCIMove_async() {
         SearchResult result = Go(m_Limits);
-        sync_printf("bestmove %s\n", result.best != Move() ? MoveToString(result.best).c_str() : "0000");
+        std::string bestmove = result.best != Move() ? MoveToString(result.best) : "0000";
+        if (result.ponder != Move()) bestmove += " ponder " + MoveToString(result.ponder);
+        sync_printf("bestmove %s\n", bestmove.c_str());
+    }
+
+    // The reply to best the search expects, checked against the position it leads to. Taken from the
+    // transposition table when the PV ends at best.
+    Move PonderMove(Move best, PackedMove expected) {
+        if (best == Move()) return Move();
+        m_Position.MovePiece(best);
+        if (expected == 0) {
+            TTEntry* entry = m_Table->Probe(m_Position.m_Hash);
+            if (entry != nullptr) expected = entry->m_BestMove;
+        }
+        Move reply = m_Position.UnpackMove(expected);
+        if (reply != Move() && !(m_Position.IsPseudoLegal(reply) && m_Position.IsLegal(reply))) reply = Move();
+        m_Position.UndoMove(best);
+        return reply;
     }
 
     SearchResult Go(const SearchLimits& limits) {
         m_Limits = limits;
         m_Running = true;
-        m_Timer.Start();
+        const bool managed = m_Limits.optimumTimeMs >= 0;
+        {
+            // A ponderhit that came before this counts from here
+            std::lock_guard<std::mutex> lock(m_PonderMutex);
+            m_Timer.Start();
+            m_PonderHitMs = 0;
+            m_HardMs = managed ? std::min(m_Limits.optimumTimeMs, m_Limits.maxTimeMs) : m_Limits.maxTimeMs;
+            m_NodeLimit = NodeBudget();
+            if (m_Limits.maxTimeMs >= 0 && m_Limits.nodesPerMs == 0) {
+                m_Watchdog.Start(-1, [this] { m_Running = false; });
+            }
+            if (!m_Pondering) SetHardLimit(m_HardMs);
+        }
+        TimeManager timeManager;
 
         m_Maxdepth = 0;
 
         m_NodeCnt = 1;
+        m_QNodeCnt = 0;
 
-        //MoveStack movestack[64] = {};
-        MoveStack* stack = new MoveStack[MAX_DEPTH];
-
+        MoveStack* stack = m_Stack.get();
         for (int i = 0; i < MAX_DEPTH; i++) {
-            (stack + i)->m_Ply = i;
+            stack[i] = MoveStack();
+            stack[i].m_Ply = i;
         }
+        std::fill(std::begin(m_PV.m_Length), std::end(m_PV.m_Length), 0);
 
         const int depthCap = std::min(m_Limits.maxDepth, (int)MAX_DEPTH);
 
+        // The first depth takes the root moves in the order the move generator gives them
+        m_RootMoves.clear();
+        {
+            TTEntry* entry = m_Table->Probe(m_Position.m_Hash);
+            MoveGen moveGen(m_Position, entry != nullptr ? m_Position.UnpackMove(entry->m_BestMove) : Move(), false);
+            Move move;
+            while ((move = moveGen.Next()) != 0) {
+                const std::vector<Move>& only = m_Limits.searchMoves;
+                if (only.empty() || std::find(only.begin(), only.end(), move) != only.end())
+                    m_RootMoves.push_back(RootMove{ move });
+            }
+        }
+        const int lines = std::min<int>(m_MultiPV, m_RootMoves.size());
+        std::vector<RootMove> bestLines;
+
         // Start timer
         Move finalMove = 0;
+        PackedMove ponderMove = 0;
         int64 bestScore = -MATE_SCORE;
         int64 rootAlpha = MIN_ALPHA;
         int64 rootBeta = MAX_BETA;
         m_RootDelta = 10;
         // Iterative deepening
         while (!ShouldStop() && depthCap > m_Maxdepth) {
-            bestScore = -MATE_SCORE;
-
-            m_RootDelta = 10;
-            rootAlpha = MIN_ALPHA;
-            rootBeta = MAX_BETA;
-
-            int64 alpha, beta;
+            // The window the first line was finally searched with, the one the root entry's bound refers to
+            int64 alpha = MIN_ALPHA, beta = MAX_BETA;
 
             m_Maxdepth++;
 
-            TTEntry* entry = m_Table->Probe(m_Position.m_Hash);
-            if (entry != nullptr) {
-                rootAlpha = entry->m_Score - m_RootDelta;
-                rootBeta = entry->m_Score + m_RootDelta;
-            }
-            int failHigh = 0;
-
-            // Aspiration window
-            while (true) {
-                alpha = rootAlpha;
-                beta = rootBeta;
-                bestScore =
-                    AlphaBeta<ROOT>(m_Position, stack, rootAlpha, rootBeta, std::max(1, m_Maxdepth - failHigh), false);
-
-                if (bestScore <= rootAlpha) { // Failed low
-                    rootBeta = (rootAlpha + rootBeta) / 2;
-                    rootAlpha = std::max(bestScore - m_RootDelta, MIN_ALPHA);
-                    failHigh = 0;
-                } else if (bestScore >= rootBeta) { // Failed high
-                    rootBeta = std::min(bestScore + m_RootDelta, MAX_BETA);
-                    failHigh++;
-                } else {
-                    break; // We found good bounds so exit out
+            for (RootMove& rootMove : m_RootMoves) rootMove.previousScore = rootMove.score;
+            uint64 rootNodes = 0;
+
+            // Each line gets its own window, with the moves of the lines above it left out. With no legal move
+            // the one search still finds the mate or stalemate.
+            for (m_PVIdx = 0; m_PVIdx < std::max(lines, 1); m_PVIdx++) {
+                m_RootDelta = 10;
+                rootAlpha = MIN_ALPHA;
+                rootBeta = MAX_BETA;
+
+                TTEntry* entry = m_PVIdx == 0 ? m_Table->Probe(m_Position.m_Hash) : nullptr;
+                const int64 previous = m_PVIdx > 0 ? m_RootMoves[m_PVIdx].previousScore : -MATE_SCORE;
+                if (entry != nullptr) {
+                    rootAlpha = entry->m_Score - m_RootDelta;
+                    rootBeta = entry->m_Score + m_RootDelta;
+                } else if (previous != -MATE_SCORE) {
+                    rootAlpha = std::max(previous - m_RootDelta, MIN_ALPHA);
+                    rootBeta = std::min(previous + m_RootDelta, MAX_BETA);
                 }
+                int failHigh = 0;
+                uint64 nodesBefore = m_NodeCnt;
+
+                // Aspiration window
+                while (true) {
+                    if (m_PVIdx == 0) {
+                        alpha = rootAlpha;
+                        beta = rootBeta;
+                    }
+                    nodesBefore = m_NodeCnt;
+                    const int depth = std::max(1, m_Maxdepth - failHigh);
+                    bestScore = m_Position.m_WhiteMove
+                                    ? AlphaBeta<ROOT, WHITE>(m_Position, stack, rootAlpha, rootBeta, depth, false)
+                                    : AlphaBeta<ROOT, BLACK>(m_Position, stack, rootAlpha, rootBeta, depth, false);
+
+                    if (bestScore <= rootAlpha) { // Failed low
+                        rootBeta = (rootAlpha + rootBeta) / 2;
+                        rootAlpha = std::max(bestScore - m_RootDelta, MIN_ALPHA);
+                        failHigh = 0;
+                    } else if (bestScore >= rootBeta) { // Failed high
+                        rootBeta = std::min(bestScore + m_RootDelta, MAX_BETA);
+                        failHigh++;
+                    } else {
+                        break; // We found good bounds so exit out
+                    }
 
-                m_RootDelta *= 1.5;
+                    m_RootDelta *= 1.5;
+                }
+                if (ShouldStop()) break;
+                if (m_PVIdx == 0) rootNodes = m_NodeCnt - nodesBefore;
+                if (m_PVIdx < lines) std::stable_sort(m_RootMoves.begin() + m_PVIdx, m_RootMoves.end());
             }
             if (ShouldStop()) break;
 
+            if (lines > 0) {
+                std::stable_sort(m_RootMoves.begin(), m_RootMoves.begin() + lines);
+                bestLines.assign(m_RootMoves.begin(), m_RootMoves.begin() + lines);
+                bestScore = m_RootMoves[0].score;
+                finalMove = m_RootMoves[0].move;
+                ponderMove = m_RootMoves[0].pv.size() > 1 ? m_RootMoves[0].pv[1] : 0;
+            }
+
             // Print pv and search info
             if (!m_Limits.silent) {
-                sync_printf("info depth %i score cp %" PRId64 " time %" PRId64 " nodes %" PRIu64 " tps %" PRIu64 "\n",
-                            m_Maxdepth, bestScore, (int64)m_Timer.EndMs(), m_NodeCnt,
-                            (uint64)(m_NodeCnt / m_Timer.End()));
-                std::ostringstream oss;
-                oss << "info pv";
-                for (int i = 0; i < MAX_DEPTH && stack->m_PV[i] != Move(); i++) {
-                    oss << " " << MoveToString(stack->m_PV[i]);
+                for (int k = 0; k < lines; k++) {
+                    // The line number only once there is more than one, so single line output stays as it was
+                    const std::string multiPV = m_MultiPV > 1 ? " multipv " + std::to_string(k + 1) : "";
+                    sync_printf("info depth %i%s score cp %" PRId64 " time %" PRId64 " nodes %" PRIu64
+                                " tps %" PRIu64 "\n",
+                                m_Maxdepth, multiPV.c_str(), m_RootMoves[k].score, (int64)m_Timer.EndMs(), m_NodeCnt,
+                                (uint64)(m_NodeCnt / m_Timer.End()));
+                    std::ostringstream oss;
+                    oss << "info" << multiPV << " pv";
+                    for (PackedMove move : m_RootMoves[k].pv) oss << " " << MoveToString(UnpackMove(move));
+                    oss << "\n";
+                    sync_printf("%s", oss.str().c_str());
                 }
-                oss << "\n";
-                sync_printf("%s", oss.str().c_str());
             }
 
-            if (stack->m_PV[0] != Move()) finalMove = stack->m_PV[0];
-
             m_Table->Enter(m_Position.m_Hash, TTEntry(m_Position.m_Hash, finalMove, bestScore,
-                                                      bestScore >= beta ? LOWER_BOUND : EXACT_BOUND, 0, m_Maxdepth,
+                                                      bestScore >= beta    ? LOWER_BOUND
+                                                      : bestScore <= alpha ? UPPER_BOUND
+                                                                           : EXACT_BOUND,
+                                                      0, m_Maxdepth,
                                                       m_Position.m_FullMoves, true));
 
-            if (m_Limits.maxTimeMs >= 0 && m_Timer.EndMs() * 2 >= m_Limits.maxTimeMs)
-                break; // We won't have enough time to calculate more depth anyway
-            if (bestScore >= MATE_SCORE - MAX_DEPTH || bestScore <= -MATE_SCORE + MAX_DEPTH)
+            {
+                std::lock_guard<std::mutex> lock(m_PonderMutex);
+                TakePonderHit();
+                int64 soft = m_Limits.maxTimeMs;
+                if (managed) {
+                    const uint64 bestNodes = lines > 0 ? m_RootMoves[0].nodes : 0;
+                    soft = m_Limits.optimumTimeMs * timeManager.Scale(finalMove, bestScore, bestNodes, rootNodes);
+                    m_HardMs = std::min(soft, m_Limits.maxTimeMs);
+                    if (!m_Pondering) SetHardLimit(m_PonderHitMs + m_HardMs);
+                }
+                if (soft >= 0 && !m_Pondering && Elapsed() * 2 >= soft)
+                    break; // The next depth would most likely run past it
+            }
+            if (m_Limits.mate > 0) {
+                if (bestScore >= MATE_SCORE - (2 * m_Limits.mate - 1)) break; // A mate as short as asked for
+            } else if (bestScore >= MATE_SCORE - MAX_DEPTH || bestScore <= -MATE_SCORE + MAX_DEPTH)
                 break; // Position is solved so exit out
         }
-        delete[] stack;
 
+        // The GUI expects no bestmove before ponderhit or stop, even with nothing left to search
+        {
+            std::unique_lock<std::mutex> lock(m_PonderMutex);
+            m_PonderDone.wait(lock, [this] { return !m_Pondering || !m_Running; });
+        }
+        m_Watchdog.Stop();
+        m_Pondering = false;
         m_Running = false;
-
-        if (finalMove == Move()) { // Stopped before a single depth finished, any legal move beats none
-            std::vector<Move> moves = GenerateMoves<ALL>(m_Position);
-            if (!moves.empty()) finalMove = moves[0];
+        if (managed && m_Limits.nodesPerMs > 0) { // Paid out of our own clock
+            m_NodesLeft = std::max<int64>(m_NodesLeft - m_NodeCnt + m_NodesIncrement, 1);
         }
 
+        // Stopped before a single depth finished, any move beats none
+        if (finalMove == Move() && !m_RootMoves.empty()) finalMove = m_RootMoves[0].move;
+
         SearchResult result;
         result.best = finalMove;
+        result.ponder = PonderMove(finalMove, ponderMove);
         result.score = bestScore;
         result.nodes = m_NodeCnt;
+        result.qnodes = m_QNodeCnt;
         result.depth = m_Maxdepth;
+        result.lines = std::move(bestLines);
         return result;
     }
 
@@ -24,6 +24,7 @@ namespace TableBase {
     static char pchr[] = { 'K', 'Q', 'R', 'B', 'N', 'P' };
 
     static int TBnum_piece, TBnum_pawn;
+    static int TB_largest; // Pieces in the largest table found
     static TBEntry_piece TB_piece[TBMAX_PIECE];
     static TBEntry_pawn TB_pawn[TBMAX_PAWN];
 
@@ -59,68 +60,14 @@ namespace TableBase {
         *str++ = 0;
     }
 
-    static uint64 Material_Key(const Position& board) {
-        const uint8_t wp = CountBits(board.m_WhitePawn), wkn = CountBits(board.m_WhiteKnight),
-                      wb = CountBits(board.m_WhiteBishop), wr = CountBits(board.m_WhiteRook),
-                      wq = CountBits(board.m_WhiteQueen), wk = CountBits(board.m_WhiteKing),
-                      bp = CountBits(board.m_BlackPawn), bkn = CountBits(board.m_BlackKnight),
-                      bb = CountBits(board.m_BlackBishop), br = CountBits(board.m_BlackRook),
-                      bq = CountBits(board.m_BlackQueen), bk = CountBits(board.m_BlackKing);
-
-        uint64 key = 0;
-        if (wp) {
-            key ^= Lookup::zobrist[wp - 1];
-        }
-        if (bp) {
-            key ^= Lookup::zobrist[64 + bp - 1];
-        }
-        if (wkn) {
-            key ^= Lookup::zobrist[128 + wkn - 1];
-        }
-        if (bkn) {
-            key ^= Lookup::zobrist[64 + 128 + wkn - 1];
-        }
-        if (wb) {
-            key ^= Lookup::zobrist[128 * 2 + wb - 1];
-        }
-        if (bb) {
-            key ^= Lookup::zobrist[64 + 128 * 2 + bb - 1];
-        }
-        if (wr) {
-            key ^= Lookup::zobrist[128 * 3 + wr - 1];
-        }
-        if (br) {
-            key ^= Lookup::zobrist[64 + 128 * 3 + br - 1];
-        }
-        if (wq) {
-            key ^= Lookup::zobrist[128 * 4 + wq - 1];
-        }
-        if (bq) {
-            key ^= Lookup::zobrist[64 + 128 * 4 + bq - 1];
-        }
-
-        // White and black king are always present
-        key ^= Lookup::zobrist[128 * 5];
-        key ^= Lookup::zobrist[128 * 5 + 64];
-
-        return key;
-    }
-
+    // The position's material key, or that of the colors swapped. The same keys PCSHashKey gives a table.
     static uint64 Calc_Key(const Position& board, bool mirror) {
-        bool color = mirror;
-        int pt;
-        int i;
-        uint64 key = 0;
+        if (!mirror) return board.m_MaterialKey;
 
-        for (pt = (int)PieceType::KING; pt >= (int)PieceType::PAWN; pt--) {
-            if ((i = CountBits(board.m_Pieces[pt][color])) > 0) {
-                key ^= Lookup::zobrist[color * 64 + (pt - 1) * 128 + i - 1];
-            }
-        }
-        color = !color;
-        for (pt = (int)PieceType::KING; pt >= (int)PieceType::PAWN; pt--) {
-            if ((i = CountBits(board.m_Pieces[pt][color])) > 0) {
-                key ^= Lookup::zobrist[color * 64 + (pt - 1) * 128 + i - 1];
+        uint64 key = 0;
+        for (int pt = (int)PieceType::PAWN; pt <= (int)PieceType::KING; pt++) {
+            for (int color = 0; color < 2; color++) {
+                for (int i = CountBits(board.m_Pieces[pt][color]) - 1; i >= 0; i--) key ^= MaterialZobrist(pt, !color, i);
             }
         }
 
@@ -655,10 +602,10 @@ namespace TableBase {
 
 
         for (pt = (int)PieceType::PAWN; pt <= (int)PieceType::KING; pt++)
-            for (i = 0; i < pcs[color + pt]; i++) key ^= Lookup::zobrist[i + (int)(pt - 1) * 128];
+            for (i = 0; i < pcs[color + pt]; i++) key ^= MaterialZobrist(pt, 0, i);
         color ^= 8;
         for (pt = (int)PieceType::PAWN; pt <= (int)PieceType::KING; pt++)
-            for (i = 0; i < pcs[color + pt]; i++) key ^= Lookup::zobrist[64 + i + (int)(pt - 1) * 128];
+            for (i = 0; i < pcs[color + pt]; i++) key ^= MaterialZobrist(pt, 1, i);
 
         return key;
     }
@@ -727,6 +674,7 @@ namespace TableBase {
         entry->ready = 0;
         entry->num = 0;
         for (i = 0; i < 16; i++) entry->num += pcs[i];
+        TB_largest = std::max<int>(TB_largest, entry->num);
         entry->symmetric = (key == key2);
         entry->has_pawns = (pcs[(int)PieceType::PAWN] + pcs[(int)PieceType::PAWN | 8] > 0);
 
@@ -1132,7 +1080,7 @@ namespace TableBase {
         uint8 res;
         int p[TBPIECES];
 
-        uint64 key = Material_Key(board);
+        uint64 key = board.m_MaterialKey;
 
         // Check if we have this particular tablebase
         ptr2 = TB_hash[key >> (64 - TBHASHBITS)];
@@ -1304,7 +1252,7 @@ namespace TableBase {
         int p[TBPIECES];
 
         // Obtain the position's material signature key.
-        uint64 key = Material_Key(board);
+        uint64 key = board.m_MaterialKey;
 
         if (DTZ_table[0].key1 != key && DTZ_table[0].key2 != key) {
             for (i = 1; i < DTZ_ENTRIES; i++)
@@ -1498,6 +1446,7 @@ namespace TableBase {
         }
 
         TBnum_piece = TBnum_pawn = 0;
+        TB_largest = 0;
 
         for (i = 0; i < (1 << TBHASHBITS); i++) {
             for (j = 0; j < HSHMAX; j++) {
@@ -1544,4 +1493,8 @@ namespace TableBase {
 
         printf("info string found %d tablebases\n", TBnum_piece + TBnum_pawn);
     }
-}
\ No newline at end of file
+
+    int MaxPieces() {
+        return TB_largest;
+    }
+}
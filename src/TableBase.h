@@ -130,4 +130,7 @@ namespace TableBase {
 
     int Probe_WDL(Position& board, int* success);
     int Probe_DTZ(Position& board, int* success);
+
+    // Pieces in the largest table found, none until Init finds some
+    int MaxPieces();
 }
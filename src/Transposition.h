@@ -12,10 +12,10 @@ struct TTEntry {
     TTEntry() = default;
 
     TTEntry(uint64 hash, Move bestmove, int64 eval, Bound bound, int ply, int depth, int moves, bool pv)
-        : m_BestMove(bestmove), m_Ply(ply), m_Depth(depth), m_Moves(moves), m_Hash(hash), m_Score(eval), m_Bound(bound),
+        : m_BestMove(PackMove(bestmove)), m_Ply(ply), m_Depth(depth), m_Moves(moves), m_Hash(hash), m_Score(eval), m_Bound(bound),
           m_PV(pv) {}
 
-    Move m_BestMove = 0;
+    PackedMove m_BestMove = 0; // Unpacked by the position that probes it
     short m_Ply = 0;
     short m_Depth = 0;
     short m_Moves = 0;
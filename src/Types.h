@@ -28,21 +28,3 @@ constexpr Color operator!(Color color) {
 }
 
 enum PieceType : int { NONE = 0, PAWN = 1, KNIGHT = 2, BISHOP = 3, ROOK = 4, QUEEN = 5, KING = 6 };
-
-struct BoardInfo {
-    BoardInfo()
-        : m_WhiteMove(WHITE), m_EnPassant(0), m_WhiteCastleKing(true), m_WhiteCastleQueen(true),
-          m_BlackCastleKing(true), m_BlackCastleQueen(true), m_HalfMoves(0), m_FullMoves(0) {}
-
-    Color m_WhiteMove;
-    BitBoard m_EnPassant;
-
-    bool m_WhiteCastleKing;
-    bool m_WhiteCastleQueen;
-
-    bool m_BlackCastleKing;
-    bool m_BlackCastleQueen;
-
-    uint64 m_HalfMoves;
-    uint64 m_FullMoves;
-};
\ No newline at end of file
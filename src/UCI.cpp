@@ -12,7 +12,7 @@ static void GetToken(std::istringstream& uip, std::string& token) {
     uip >> token;
 }
 
-// A fen is expected to have 6 fields, the parser reads past the end without them
+// Fills in the fields a GUI left out, an empty board is turned down by the parser
 static std::string BuildFen(const std::vector<std::string>& fields) {
     static const char* defaults[6] = { "8/8/8/8/8/8/8/8", "w", "-", "-", "0", "1" };
     std::string fen;
@@ -45,6 +45,14 @@ void UCI::SetOption(std::istringstream& istream) {
         else sync_printf("info string bad Hash value %s\n", value.c_str());
     } else if (name == "SyzygyPath") {
         if (!value.empty() && value != "<empty>") TableBase::Init(value);
+    } else if (name == "MultiPV") {
+        int lines = std::atoi(value.c_str());
+        if (lines >= 1 && lines <= MAX_MULTIPV) m_Search.SetMultiPV(lines);
+        else sync_printf("info string bad MultiPV value %s\n", value.c_str());
+    } else if (name == "nodestime") {
+        m_Search.SetNodesTime(std::atoi(value.c_str()));
+    } else if (name == "Ponder") {
+        // Only tells us the GUI may send go ponder, which needs nothing set up
     } else {
         sync_printf("info string unknown option %s\n", name.c_str());
     }
@@ -52,7 +60,7 @@ void UCI::SetOption(std::istringstream& istream) {
 
 void UCI::NewGame() {
     m_Search.Stop();
-    m_Search.ClearTables();
+    m_Search.NewGame();
     m_Search.LoadPosition(Lookup::starting_pos);
     m_CachedFen = Lookup::starting_pos;
     m_CachedMoves.clear();
@@ -66,7 +74,12 @@ void UCI::SetPosition(const std::string& fen, const std::vector<std::string>& mo
         && std::equal(m_CachedMoves.begin(), m_CachedMoves.end(), moves.begin())) {
         applied = m_CachedMoves.size(); // Extending the previous position keeps the transposition table
     } else {
-        m_Search.LoadPosition(fen);
+        const FenError error = m_Search.LoadPosition(fen);
+        if (error != FEN_OK) {
+            sync_printf("info string invalid fen %s: %s\n", fen.c_str(), FenErrorString(error));
+            m_CachedFen.clear();
+            return;
+        }
         m_CachedFen = fen;
         m_CachedMoves.clear();
     }
@@ -74,9 +87,9 @@ void UCI::SetPosition(const std::string& fen, const std::vector<std::string>& mo
     for (size_t i = applied; i < moves.size(); i++) {
         const std::string& str = moves[i];
         Move move = str.size() >= 4 ? m_Search.GetMove(str) : Move();
-        if (MovePieceType(move) == NOPIECE) {
-            sync_printf("info string illegal move %s in position %s\n", str.c_str(),
-                        m_Search.m_Position.ToFen().c_str());
+        const Position& position = m_Search.m_Position;
+        if (!position.IsPseudoLegal(move) || !position.IsLegal(move)) {
+            sync_printf("info string illegal move %s in position %s\n", str.c_str(), position.ToFen().c_str());
             m_CachedFen.clear();
             return;
         }
@@ -85,6 +98,64 @@ void UCI::SetPosition(const std::string& fen, const std::vector<std::string>& mo
     }
 }
 
+// go [<limit> <value>]... [searchmoves <move>...], the moves run until the next keyword
+GoCommand UCI::ParseGo(std::istringstream& istream) {
+    GoCommand go;
+    bool searchmoves = false;
+    std::vector<Move> legal; // Only generated once searchmoves shows up
+    std::string token;
+
+    while (istream >> token) {
+        if (token == "perft") {
+            istream >> token;
+            go.perft = std::atoi(token.c_str());
+        } else if (token == "depth") {
+            istream >> token;
+            go.limits.maxDepth = std::clamp(std::atoi(token.c_str()), 1, MAX_DEPTH);
+            go.time = -1;
+        } else if (token == "nodes") {
+            istream >> token;
+            go.limits.maxNodes = std::max(std::atoll(token.c_str()), 1ll);
+            go.time = -1;
+        } else if (token == "mate") {
+            istream >> token;
+            go.limits.mate = std::max(std::atoi(token.c_str()), 1);
+            go.time = -1;
+        } else if (token == "movetime") {
+            istream >> token;
+            go.time = std::atoi(token.c_str());
+            go.movetime = true;
+        } else if (token == "infinite") {
+            go.time = -1;
+        } else if (token == "ponder") {
+            go.ponder = true;
+        } else if (token == "wtime") {
+            istream >> token;
+            go.wtime = std::atoi(token.c_str());
+        } else if (token == "btime") {
+            istream >> token;
+            go.btime = std::atoi(token.c_str());
+        } else if (token == "winc") {
+            istream >> token;
+            go.winc = std::atoi(token.c_str());
+        } else if (token == "binc") {
+            istream >> token;
+            go.binc = std::atoi(token.c_str());
+        } else if (token == "movestogo") {
+            istream >> token;
+            go.movestogo = std::max(std::atoi(token.c_str()), 0);
+        } else if (token == "searchmoves") {
+            if (!searchmoves) legal = GenerateMoves<ALL>(m_Search.m_Position);
+            searchmoves = true;
+        } else if (searchmoves) { // An illegal one is dropped
+            auto it = std::find_if(legal.begin(), legal.end(), [&](Move move) { return MoveToString(move) == token; });
+            if (it != legal.end()) go.limits.searchMoves.push_back(*it);
+            else sync_printf("info string ignoring searchmove %s\n", token.c_str());
+        }
+    }
+    return go;
+}
+
 void UCI::Start() {
     std::string command;
     bool stop = false;
@@ -109,6 +180,9 @@ void UCI::Start() {
             printf("id author Miles\n");
             printf("option name Hash type spin default %llu min 1 max 4096\n", DEFAULT_HASH_MB);
             printf("option name SyzygyPath type string default <empty>\n");
+            printf("option name Ponder type check default false\n");
+            printf("option name nodestime type spin default 0 min 0 max 100000\n");
+            printf("option name MultiPV type spin default 1 min 1 max %i\n", MAX_MULTIPV);
             printf("uciok\n");
         } else if (token == "isready") {
             printf("readyok\n");
@@ -144,6 +218,8 @@ void UCI::Start() {
             sync_printf("Fen: %s\n", m_Search.m_Position.ToFen().c_str());
         } else if (token == "stop") {
             m_Search.Stop();
+        } else if (token == "ponderhit") {
+            m_Search.PonderHit();
         } else if (token == "perft") {
             GetToken(istream, token);
             int depth = std::atoi(token.c_str());
@@ -158,53 +234,17 @@ void UCI::Start() {
             BenchMode mode;
             int limit;
             ParseBenchArgs(first, second, mode, limit);
-            RunBench(mode, limit);
+            RunBench(mode, limit, DEFAULT_HASH_MB, m_Search.NodesTime());
             NewGame();
         } else if (token == "go") {
-            int64 time = 1000;
-            int64 wtime = -1;
-            int64 btime = -1;
-            int64 winc = 0;
-            int64 binc = 0;
-            int depth = MAX_DEPTH;
-            int perft = 0;
-            bool movetime = false;
-
-            while (istream >> token) {
-                if (token == "perft") {
-                    istream >> token;
-                    perft = std::atoi(token.c_str());
-                } else if (token == "depth") {
-                    istream >> token;
-                    depth = std::clamp(std::atoi(token.c_str()), 1, MAX_DEPTH);
-                    time = -1;
-                } else if (token == "movetime") {
-                    istream >> token;
-                    time = std::atoi(token.c_str());
-                    movetime = true;
-                } else if (token == "infinite") {
-                    time = -1;
-                } else if (token == "wtime") {
-                    istream >> token;
-                    wtime = std::atoi(token.c_str());
-                } else if (token == "btime") {
-                    istream >> token;
-                    btime = std::atoi(token.c_str());
-                } else if (token == "winc") {
-                    istream >> token;
-                    winc = std::atoi(token.c_str());
-                } else if (token == "binc") {
-                    istream >> token;
-                    binc = std::atoi(token.c_str());
-                }
-            }
-
-            if (perft > 0) {
-                PerftDivide(m_Search.m_Position, perft, true);
-            } else if (!movetime && wtime > 0 && btime > 0) {
-                m_Search.MoveTimed(wtime, btime, winc, binc, depth);
+            GoCommand go = ParseGo(istream);
+            if (go.perft > 0) {
+                PerftDivide(m_Search.m_Position, go.perft, true);
+            } else if (!go.movetime && go.wtime > 0 && go.btime > 0) {
+                m_Search.MoveTimed(go.limits, go.wtime, go.btime, go.winc, go.binc, go.movestogo, go.ponder);
             } else {
-                m_Search.UCIMove(time, depth);
+                go.limits.maxTimeMs = go.time;
+                m_Search.StartAsync(go.limits, go.ponder);
             }
         }
     }
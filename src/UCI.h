@@ -5,6 +5,20 @@
 #include <sstream>
 #include <vector>
 
+// The arguments of a go command
+struct GoCommand {
+    SearchLimits limits;
+    int64 time = 1000; // -1 = no time limit
+    int64 wtime = -1;
+    int64 btime = -1;
+    int64 winc = 0;
+    int64 binc = 0;
+    int movestogo = 0;
+    int perft = 0;
+    bool movetime = false;
+    bool ponder = false;
+};
+
 class UCI {
 public:
     Search m_Search;
@@ -12,6 +26,7 @@ public:
     UCI() = default;
 
     void Start();
+    GoCommand ParseGo(std::istringstream& istream);
 
 private:
     void SetPosition(const std::string& fen, const std::vector<std::string>& moves);
@@ -2,10 +2,13 @@
 #include <bit>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
 #include <cstdarg>
 #include <cstdio>
+#include <functional>
 #include <mutex>
 #include <string>
+#include <thread>
 
 #include "Types.h"
 
@@ -58,91 +61,6 @@ static inline int Signum(int val) {
     return (0 < val) - (val < 0);
 }
 
-static inline BitBoard FenToMap(const std::string& FEN, char p) {
-    int i = 0;
-    char c = {};
-    int pos = 63;
-
-    BitBoard result = 0;
-    while ((c = FEN[i++]) != ' ') {
-        BitBoard P = 1ull << pos;
-        switch (c) {
-        case '/': pos += 1; break;
-        case '1': break;
-        case '2': pos -= 1; break;
-        case '3': pos -= 2; break;
-        case '4': pos -= 3; break;
-        case '5': pos -= 4; break;
-        case '6': pos -= 5; break;
-        case '7': pos -= 6; break;
-        case '8': pos -= 7; break;
-        default:
-            if (c == p) result |= P;
-        }
-        pos--;
-    }
-    return result;
-}
-
-static inline BoardInfo FenToBoardInfo(const std::string& FEN) {
-    BoardInfo info = {};
-    size_t i = 0;
-    while (FEN[i++] != ' ') {
-        // Skip piece placement
-    }
-
-    char ac = FEN[i++]; // Active color
-    switch (ac) {
-    case 'w': info.m_WhiteMove = WHITE; break;
-    case 'b': info.m_WhiteMove = BLACK; break;
-    default: printf("Invalid FEN for active color\n"); return info;
-    }
-
-    i++;
-    info.m_BlackCastleKing = false;
-    info.m_BlackCastleQueen = false;
-    info.m_WhiteCastleKing = false;
-    info.m_WhiteCastleQueen = false;
-    char c = {};
-    while ((c = FEN[i++]) != ' ') {
-        if (c == '-') {
-            break;
-        }
-
-        switch (c) {
-        case 'K': info.m_WhiteCastleKing = true; break;
-        case 'Q': info.m_WhiteCastleQueen = true; break;
-        case 'k': info.m_BlackCastleKing = true; break;
-        case 'q': info.m_BlackCastleQueen = true; break;
-        }
-    }
-
-    while ((c = FEN[i]) == ' ') i++;
-    char a = FEN[i++];
-
-    if (a != '-') {
-        if (info.m_WhiteMove) {
-            info.m_EnPassant = 1ull << (40 + ('h' - a)); // TODO: need to be tested
-        } else {
-            info.m_EnPassant = 1ull << (16 + ('h' - a)); // TODO: need to be tested
-        }
-    } else {
-        info.m_EnPassant = 0;
-    }
-
-    info.m_HalfMoves = 0;
-    info.m_FullMoves = 0;
-    int t = 1;
-
-    while ((c = FEN[i++]) != ' ');
-    while ((c = FEN[i++]) != ' ') info.m_HalfMoves = info.m_HalfMoves * 10 + (int)(c - '0');
-    while (i < FEN.size() && FEN[i] >= '0' && FEN[i] <= '9') {
-        c = FEN[i++];
-        info.m_FullMoves = info.m_FullMoves * 10 + (c - '0');
-    }
-    return info;
-}
-
 static inline void PrintBitBoard(BitBoard map) {
     for (int i = 63; i >= 0; i--) {
         if ((map & (1ull << i)) > 0) {
@@ -196,6 +114,65 @@ public:
     }
 };
 
+// Calls back from a thread of its own once the deadline has passed, unless it is stopped first. The deadline can be
+// moved from any thread while it runs, or left open until it is known. Start and Stop belong to one thread.
+class Watchdog {
+private:
+    std::mutex m_Mutex;
+    std::condition_variable m_Changed;
+    bool m_Cancelled = false;
+    std::chrono::steady_clock::time_point m_Start;
+    int64 m_DeadlineMs = -1; // After m_Start, -1 while it is open
+    std::thread m_Thread;
+
+public:
+    Watchdog() = default;
+    ~Watchdog() { Stop(); }
+
+    Watchdog(const Watchdog&) = delete;
+    Watchdog& operator=(const Watchdog&) = delete;
+
+    // Counts from now, a negative time leaves the deadline open
+    void Start(int64 ms, std::function<void()> expired) {
+        Stop();
+        m_Cancelled = false;
+        m_Start = std::chrono::steady_clock::now();
+        m_DeadlineMs = ms;
+        m_Thread = std::thread([this, expired = std::move(expired)] {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            while (!m_Cancelled) {
+                const int64 deadline = m_DeadlineMs;
+                auto changed = [&] { return m_Cancelled || m_DeadlineMs != deadline; };
+                if (deadline < 0) {
+                    m_Changed.wait(lock, changed);
+                } else if (!m_Changed.wait_until(lock, m_Start + std::chrono::milliseconds(deadline), changed)) {
+                    expired();
+                    return;
+                }
+            }
+        });
+    }
+
+    // Moves the deadline to ms after the start, which may be earlier than before or already gone
+    void SetDeadline(int64 ms) {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_DeadlineMs = ms;
+        }
+        m_Changed.notify_one();
+    }
+
+    void Stop() {
+        if (!m_Thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Cancelled = true;
+        }
+        m_Changed.notify_one();
+        m_Thread.join();
+    }
+};
+
 // All squares below / above sq.
 static inline constexpr BitBoard GetLower(int sq) {
     return (1ull << sq) - 1;
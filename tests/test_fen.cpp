@@ -52,5 +52,60 @@ int main() {
         }
     }
 
+    printf("-- the hashes built while parsing match a full recompute\n");
+    for (const char* fen : fens) {
+        Position pos;
+        CHECK_EQ(pos.SetPosition(fen), FEN_OK);
+        CHECK_EQ(pos.m_Hash, Zobrist_Hash(pos));
+        CHECK_EQ(pos.m_PawnHash, Zobrist_PawnHash(pos));
+    }
+
+    printf("-- move counters may be left out\n");
+    {
+        Position pos;
+        CHECK_EQ(pos.SetPosition("4k3/8/8/8/8/8/8/4K2R w K -"), FEN_OK);
+        CHECK_EQ_STR(pos.ToFen(), "4k3/8/8/8/8/8/8/4K2R w K - 0 1");
+        CHECK_EQ(pos.SetPosition("4k3/8/8/8/8/8/8/4K2R b - - 12"), FEN_OK);
+        CHECK_EQ_STR(pos.ToFen(), "4k3/8/8/8/8/8/8/4K2R b - - 12 1");
+    }
+
+    printf("-- malformed fens are turned down and leave the position alone\n");
+    struct Malformed {
+        const char* fen;
+        FenError error;
+    };
+    const Malformed malformed[] = {
+        { "", FEN_PLACEMENT },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP w KQkq - 0 1", FEN_PLACEMENT },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR/8 w KQkq - 0 1", FEN_PLACEMENT },
+        { "rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", FEN_PLACEMENT },
+        { "rnbqkbnr/ppppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", FEN_PLACEMENT },
+        { "rnbqkbnr/pppppppp/7/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", FEN_PLACEMENT },
+        { "rnbqkbnr/pppppxpp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", FEN_PLACEMENT },
+        { "Pnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", FEN_PLACEMENT },
+        { "8/8/8/8/8/8/8/8 w - - 0 1", FEN_KINGS },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKKNR w KQkq - 0 1", FEN_KINGS },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR", FEN_SIDE },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR x KQkq - 0 1", FEN_SIDE },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w", FEN_CASTLING },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkx - 0 1", FEN_CASTLING },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KKq - 0 1", FEN_CASTLING },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq", FEN_EN_PASSANT },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq e3 0 1", FEN_EN_PASSANT },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq e6 0 1", FEN_EN_PASSANT },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq i6 0 1", FEN_EN_PASSANT },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - x 1", FEN_COUNTERS },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1x", FEN_COUNTERS },
+    };
+    for (const Malformed& test : malformed) {
+        Position pos;
+        pos.SetPosition(kKiwipete);
+        const FenError error = pos.SetPosition(test.fen);
+        if (error != test.error) printf("  '%s': got %s\n", test.fen, FenErrorString(error));
+        CHECK_EQ(error, test.error);
+        CHECK_EQ_STR(pos.ToFen(), kKiwipete);
+        CHECK_EQ(pos.m_Hash, Zobrist_Hash(pos));
+    }
+
     return TestSummary("test_fen");
 }
@@ -0,0 +1,229 @@
+#include "TestUtil.h"
+#include "Positions.h"
+
+#include "Search.h"
+#include "MoveGen.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+static bool Accepted(const Position& pos, Move move) {
+    return pos.IsPseudoLegal(move) && pos.IsLegal(move);
+}
+
+// Every move generated anywhere in the tree, so most of them belong to some other position
+static void Collect(Position& pos, int depth, std::set<Move>& pool) {
+    std::vector<Move> moves = GenerateMoves<ALL>(pos);
+    pool.insert(moves.begin(), moves.end());
+    if (depth <= 1) return;
+    for (Move move : moves) {
+        pos.MovePiece(move);
+        Collect(pos, depth - 1, pool);
+        pos.UndoMove(move);
+    }
+}
+
+// The validator has to agree with the generator on every candidate, legal here or not
+static void Walk(Position& pos, int depth, const std::vector<Move>& pool, const char* name) {
+    std::vector<Move> legal = GenerateMoves<ALL>(pos);
+    std::sort(legal.begin(), legal.end());
+
+    for (Move move : pool) {
+        bool expected = std::binary_search(legal.begin(), legal.end(), move);
+        bool actual = Accepted(pos, move);
+        if (actual != expected) {
+            printf("  %s: %s %s, fen %s\n", name, MoveToString(move).c_str(), expected ? "rejected" : "accepted",
+                   pos.ToFen().c_str());
+        }
+        CHECK_EQ(actual, expected);
+    }
+
+    if (depth <= 1) return;
+    for (Move move : legal) {
+        pos.MovePiece(move);
+        Walk(pos, depth - 1, pool, name);
+        pos.UndoMove(move);
+    }
+}
+
+// The quiet check stage has to give exactly the quiet moves that check, castling aside
+static void QuietChecks(Position& pos, int depth, const char* name) {
+    if (!pos.m_InCheck) {
+        std::vector<Move> expected;
+        for (Move move : GenerateMoves<ALL>(pos)) {
+            if (CaptureType(move) != NOPIECE || Promotion(move) || Castle(move)) continue;
+            pos.MovePiece(move);
+            if (pos.m_InCheck) expected.push_back(move);
+            pos.UndoMove(move);
+        }
+
+        std::vector<Move> actual;
+        MoveGen moveGen(pos, 0, true, true);
+        Move move;
+        while ((move = moveGen.Next()) != 0) {
+            if (moveGen.QuietCheck()) actual.push_back(move);
+        }
+
+        std::sort(expected.begin(), expected.end());
+        std::sort(actual.begin(), actual.end());
+        if (actual != expected) printf("  %s: quiet checks differ, fen %s\n", name, pos.ToFen().c_str());
+        CHECK(actual == expected);
+    }
+
+    if (depth <= 1) return;
+    for (Move move : GenerateMoves<ALL>(pos)) {
+        pos.MovePiece(move);
+        QuietChecks(pos, depth - 1, name);
+        pos.UndoMove(move);
+    }
+}
+
+// GivesCheck has to agree with the position each move leads to
+static void GivesCheck(Position& pos, int depth, const char* name) {
+    std::vector<Move> moves = GenerateMoves<ALL>(pos);
+
+    // Made before the node has its checking squares, so MovePiece still finds the check on the board
+    std::vector<bool> expected;
+    for (Move move : moves) {
+        pos.MovePiece(move);
+        expected.push_back(pos.m_InCheck);
+        pos.UndoMove(move);
+    }
+    for (size_t i = 0; i < moves.size(); i++) {
+        if (pos.GivesCheck(moves[i]) != expected[i]) {
+            printf("  %s: %s, fen %s\n", name, MoveToString(moves[i]).c_str(), pos.ToFen().c_str());
+        }
+        CHECK_EQ(pos.GivesCheck(moves[i]), (bool)expected[i]);
+    }
+
+    if (depth <= 1) return;
+    for (Move move : moves) {
+        pos.MovePiece(move);
+        GivesCheck(pos, depth - 1, name);
+        pos.UndoMove(move);
+    }
+}
+
+// A stored move comes back as the move generated here, and one stored elsewhere only passes if it is a move here
+static void Packed(Position& pos, int depth, const std::vector<Move>& pool, const char* name) {
+    std::vector<Move> legal = GenerateMoves<ALL>(pos);
+    std::vector<PackedMove> packed;
+    for (Move move : legal) {
+        if (pos.UnpackMove(PackMove(move)) != move) {
+            printf("  %s: %s unpacks differently, fen %s\n", name, MoveToString(move).c_str(), pos.ToFen().c_str());
+        }
+        CHECK_EQ(pos.UnpackMove(PackMove(move)), move);
+        packed.push_back(PackMove(move));
+    }
+    std::sort(packed.begin(), packed.end());
+
+    for (Move move : pool) {
+        bool expected = std::binary_search(packed.begin(), packed.end(), PackMove(move));
+        CHECK_EQ(Accepted(pos, pos.UnpackMove(PackMove(move))), expected);
+    }
+
+    if (depth <= 1) return;
+    for (Move move : legal) {
+        pos.MovePiece(move);
+        Packed(pos, depth - 1, pool, name);
+        pos.UndoMove(move);
+    }
+}
+
+// Pseudo legal but leaves the king in check
+static void Illegal(const char* fen, const char* str) {
+    Search search;
+    search.LoadPosition(fen);
+    Move move = search.GetMove(str);
+    CHECK(search.m_Position.IsPseudoLegal(move));
+    CHECK(!search.m_Position.IsLegal(move));
+}
+
+// The exchange on the target square of a move, at a threshold just met and just missed
+static void See(const char* fen, const char* str, int value) {
+    Search search;
+    search.LoadPosition(fen);
+    Move move = search.GetMove(str);
+    if (!search.m_Position.SeeGe(move, value) || search.m_Position.SeeGe(move, value + 1)) {
+        printf("  see of %s is not %d: %s\n", str, value, fen);
+    }
+    CHECK(search.m_Position.SeeGe(move, value));
+    CHECK(!search.m_Position.SeeGe(move, value + 1));
+}
+
+int main() {
+    const char* const fens[] = { kStartPos, kKiwipete, kEndgame, kPromo, kMidgame, kComplex };
+    const char* const names[] = { "startpos", "kiwipete", "endgame", "promo", "midgame", "complex" };
+
+    printf("-- validator agrees with the generator on moves from every position\n");
+    std::set<Move> pool;
+    for (const char* fen : fens) {
+        Position pos;
+        pos.SetPosition(fen);
+        Collect(pos, 3, pool);
+    }
+    std::vector<Move> candidates(pool.begin(), pool.end());
+    candidates.push_back(0);
+    for (size_t i = 0; i < 6; i++) {
+        Position pos;
+        pos.SetPosition(fens[i]);
+        Walk(pos, 3, candidates, names[i]);
+    }
+
+    printf("-- stored moves unpack against the board\n");
+    for (size_t i = 0; i < 6; i++) {
+        Position pos;
+        pos.SetPosition(fens[i]);
+        Packed(pos, 2, candidates, names[i]);
+    }
+
+    printf("-- quiet checks, direct and discovered\n");
+    for (size_t i = 0; i < 6; i++) {
+        Position pos;
+        pos.SetPosition(fens[i]);
+        QuietChecks(pos, 3, names[i]);
+    }
+    Position discovered;
+    discovered.SetPosition("4k3/8/8/8/4N3/8/8/K3R3 w - - 0 1"); // Any knight move uncovers the rook
+    QuietChecks(discovered, 1, "discovered");
+
+    printf("-- moves that give check are known before they are made\n");
+    const char* const checkFens[] = {
+        "4k3/8/8/8/8/8/8/R3K2R w KQ - 0 1",         // Castling rook checks
+        "8/8/8/1k1pP2R/8/8/8/4K3 w - d6 0 2",      // En passant uncovers the rook
+        "3k4/1P6/8/8/8/8/8/4K3 w - - 0 1",         // Promotions check
+        "2k5/8/8/8/8/8/2B5/2R1K3 w - - 0 1",       // A bishop that leaves the file for a discovered check
+    };
+    for (size_t i = 0; i < 6; i++) {
+        Position pos;
+        pos.SetPosition(fens[i]);
+        GivesCheck(pos, 3, names[i]);
+    }
+    for (const char* fen : checkFens) {
+        Position pos;
+        pos.SetPosition(fen);
+        GivesCheck(pos, 2, fen);
+    }
+
+    printf("-- pins, checks and castling through attacked squares\n");
+    Illegal("8/8/8/KPp3r1/8/8/8/6k1 w - c6 0 2", "b5c6"); // En passant exposes the king along the rank
+    Illegal("4kr2/8/8/8/8/8/8/4K2R w K - 0 1", "e1g1");   // Castles through an attacked square
+    Illegal("4k3/8/8/8/8/8/8/r3K2R w K - 0 1", "e1g1");   // Castles out of check
+    Illegal("4k3/4r3/8/8/8/8/4B3/4K3 w - - 0 1", "e2d3"); // Pinned bishop leaves the file
+    Illegal("4k3/8/8/8/8/8/3q4/4K3 w - - 0 1", "e1d1");   // King steps into the queen's reach
+    Illegal("4k3/8/8/8/1b6/8/8/4K1N1 w - - 0 1", "g1f3"); // Knight ignores the check
+
+    printf("-- static exchange evaluation\n");
+    See("4k3/8/8/3p4/8/8/8/3RK3 w - - 0 1", "d1d5", 100);       // A free pawn
+    See("4k3/8/4p3/3p4/8/8/8/3RK3 w - - 0 1", "d1d5", -400);    // Taken back by a pawn
+    See("3rk3/8/8/3p4/8/8/3R4/3RK3 w - - 0 1", "d2d5", 100);    // The rook behind wins the last word
+    See("3rk3/3r4/8/3p4/8/8/3R4/3RK3 w - - 0 1", "d2d5", -400); // Both doubled, the rook is lost
+    See("4k3/8/4p3/3n4/2P5/8/8/4K3 w - - 0 1", "c4d5", 200);    // Pawn for knight
+    See("4k3/8/8/3pP3/8/8/8/4K3 w - d6 0 2", "e5d6", 100);      // En passant
+    See("4k3/8/5n2/3r4/8/8/8/3QK3 w - - 0 1", "d1d5", -600);    // Queen for a defended rook
+    See("4k3/8/8/8/8/8/8/R3K2R w KQ - 0 1", "e1g1", 0);         // Castling is even
+    See("3qk3/8/8/3p4/8/5B2/8/3RK3 w - - 0 1", "f3d5", 100);    // The queen may not take back alone
+
+    return TestSummary("test_legality");
+}
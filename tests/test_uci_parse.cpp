@@ -3,6 +3,7 @@
 
 #include "Search.h"
 #include "MoveGen.h"
+#include "UCI.h"
 
 int main() {
     printf("-- trim_str does not throw on degenerate input\n");
@@ -30,5 +31,104 @@ int main() {
         }
     }
 
+    printf("-- the ponder move is a legal reply to the best move\n");
+    search.LoadPosition(kStartPos);
+    SearchLimits limits;
+    limits.maxDepth = 6;
+    limits.silent = true;
+    SearchResult result = search.Go(limits);
+    CHECK(result.best != 0);
+    CHECK(result.ponder != 0);
+    search.m_Position.MovePiece(result.best);
+    std::vector<Move> replies = GenerateMoves<ALL>(search.m_Position);
+    CHECK(std::find(replies.begin(), replies.end(), result.ponder) != replies.end());
+    search.m_Position.UndoMove(result.best);
+
+    printf("-- MultiPV lines are distinct, best first, and the first is the best move\n");
+    search.SetMultiPV(3);
+    result = search.Go(limits);
+    search.SetMultiPV(1);
+    CHECK_EQ((int)result.lines.size(), 3);
+    for (size_t i = 0; i < result.lines.size(); i++) {
+        const RootMove& line = result.lines[i];
+        CHECK(!line.pv.empty() && search.m_Position.UnpackMove(line.pv[0]) == line.move);
+        if (i > 0) {
+            CHECK(line.score <= result.lines[i - 1].score);
+            CHECK(line.move != result.lines[i - 1].move && line.move != result.lines[0].move);
+        }
+    }
+    CHECK_EQ(result.lines[0].move, result.best);
+    CHECK_EQ(result.lines[0].score, result.score);
+
+    search.LoadPosition("7k/8/8/8/8/8/8/K7 w - - 0 1");
+    search.SetMultiPV(10);
+    result = search.Go(limits);
+    search.SetMultiPV(1);
+    CHECK_EQ((int)result.lines.size(), 3); // Only as many lines as there are moves
+    search.LoadPosition(kStartPos);
+
+    printf("-- go nodes, searchmoves and mate\n");
+    SearchLimits nodeLimits;
+    nodeLimits.maxNodes = 5000;
+    nodeLimits.silent = true;
+    CHECK_EQ(search.Go(nodeLimits).nodes, 5000ull);
+
+    search.m_Position.SetPosition(kKiwipete);
+    const std::vector<Move> all = GenerateMoves<ALL>(search.m_Position);
+    limits.searchMoves = { all.back(), all.front() };
+    result = search.Go(limits);
+    limits.searchMoves.clear();
+    CHECK(result.best == all.front() || result.best == all.back());
+
+    search.LoadPosition("6k1/5ppp/8/8/8/8/5PPP/R5K1 w - - 0 1");
+    SearchLimits mateLimits;
+    mateLimits.mate = 1;
+    mateLimits.silent = true;
+    result = search.Go(mateLimits);
+    CHECK_EQ_STR(MoveToString(result.best), "a1a8");
+    CHECK_EQ(result.score, MATE_SCORE - 1);
+    CHECK_EQ(result.depth, 1);
+    search.LoadPosition(kStartPos);
+
+    printf("-- go searchmoves ends at the next keyword\n");
+    UCI uci;
+    uci.m_Search.LoadPosition(kStartPos);
+    std::istringstream goLine("searchmoves e2e4 d2d4 e2e5 wtime 1000 btime 2000 winc 10 movestogo 5");
+    GoCommand go = uci.ParseGo(goLine);
+    CHECK_EQ((int)go.limits.searchMoves.size(), 2); // e2e5 is not legal and is dropped
+    CHECK_EQ_STR(MoveToString(go.limits.searchMoves[0]), "e2e4");
+    CHECK_EQ_STR(MoveToString(go.limits.searchMoves[1]), "d2d4");
+    CHECK_EQ(go.wtime, 1000);
+    CHECK_EQ(go.btime, 2000);
+    CHECK_EQ(go.winc, 10);
+    CHECK_EQ(go.movestogo, 5);
+    std::istringstream plainGo("wtime 1000 btime 2000");
+    CHECK(uci.ParseGo(plainGo).limits.searchMoves.empty());
+
+    printf("-- time counted in nodes stops at the same node every time\n");
+    SearchLimits nodesTime;
+    nodesTime.maxTimeMs = 40;
+    nodesTime.nodesPerMs = 1000;
+    nodesTime.silent = true;
+    search.ClearTables();
+    const uint64 first = search.Go(nodesTime).nodes;
+    search.ClearTables();
+    CHECK_EQ(search.Go(nodesTime).nodes, first);
+    CHECK(first <= 40000);
+
+    printf("-- a ponder search outlasts its time and depth until ponderhit\n");
+    SearchLimits ponderLimits;
+    ponderLimits.maxDepth = 1;
+    ponderLimits.maxTimeMs = 10;
+    search.StartAsync(ponderLimits, true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CHECK(search.IsSearching());
+    search.PonderHit();
+    Timer timer;
+    timer.Start();
+    search.JoinThreads();
+    CHECK(!search.IsSearching());
+    CHECK(timer.EndMs() < 1000);
+
     return TestSummary("test_uci_parse");
 }
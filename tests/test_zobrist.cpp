@@ -3,7 +3,9 @@
 
 #include "MoveGen.h"
 
+#include <algorithm>
 #include <cstring>
+#include <vector>
 
 struct Snapshot {
     BitBoard pieces[7][2];
@@ -14,6 +16,7 @@ struct Snapshot {
     IrreversibleState state;
     uint64 hash;
     uint64 pawnHash;
+    uint64 materialKey;
     bool inCheck;
 };
 
@@ -27,6 +30,7 @@ static Snapshot Capture(const Position& pos) {
     s.state = pos.m_States[pos.m_Ply];
     s.hash = pos.m_Hash;
     s.pawnHash = pos.m_PawnHash;
+    s.materialKey = pos.m_MaterialKey;
     s.inCheck = pos.m_InCheck;
     return s;
 }
@@ -34,9 +38,11 @@ static Snapshot Capture(const Position& pos) {
 static bool Same(const Snapshot& a, const Snapshot& b) {
     return std::memcmp(a.pieces, b.pieces, sizeof(a.pieces)) == 0 && a.board == b.board && a.whiteMove == b.whiteMove
            && a.fullMoves == b.fullMoves && a.ply == b.ply && a.state.m_CastleRights == b.state.m_CastleRights
-           && a.state.m_HalfMoves == b.state.m_HalfMoves && a.state.m_EnPassant == b.state.m_EnPassant
-           && a.state.m_Hash == b.state.m_Hash && a.hash == b.hash && a.pawnHash == b.pawnHash
-           && a.inCheck == b.inCheck;
+           && a.state.m_HalfMoves == b.state.m_HalfMoves && a.state.m_PliesFromNull == b.state.m_PliesFromNull
+           && a.state.m_EnPassant == b.state.m_EnPassant
+           && a.state.m_Hash == b.state.m_Hash && a.state.m_PawnHash == b.state.m_PawnHash
+           && a.state.m_InCheck == b.state.m_InCheck && a.state.m_MaterialKey == b.state.m_MaterialKey
+           && a.hash == b.hash && a.pawnHash == b.pawnHash && a.materialKey == b.materialKey && a.inCheck == b.inCheck;
 }
 
 static void Walk(Position& pos, int depth, const char* name) {
@@ -44,6 +50,7 @@ static void Walk(Position& pos, int depth, const char* name) {
         printf("  hash mismatch at %s: fen %s\n", name, pos.ToFen().c_str());
     }
     CHECK_EQ(Zobrist_Hash(pos), pos.m_Hash);
+    CHECK_EQ(Zobrist_MaterialKey(pos), pos.m_MaterialKey);
 
     if (depth == 0) return;
 
@@ -72,6 +79,141 @@ static void NullRoundTrip(const char* fen, const char* name) {
     CHECK(Same(before, after));
 }
 
+static Move Find(Position& pos, const char* str) {
+    for (Move move : GenerateMoves<ALL>(pos)) {
+        if (MoveToString(move) == str) return move;
+    }
+    return 0;
+}
+
+// Knights shuffling far past the length a fixed history could hold, then taken back
+static void LongGame() {
+    const char* const cycle[] = { "g1f3", "g8f6", "f3g1", "f6g8" };
+    constexpr int plies = 2000;
+
+    Position pos;
+    pos.SetPosition(kStartPos);
+    Snapshot before = Capture(pos);
+    std::vector<Move> played;
+    for (int i = 0; i < plies; i++) {
+        played.push_back(Find(pos, cycle[i % 4]));
+        pos.MovePiece(played.back());
+    }
+    CHECK_EQ(pos.m_Ply, plies);
+    CHECK_EQ(Zobrist_Hash(pos), pos.m_Hash);
+    CHECK_EQ(pos.m_States[pos.m_Ply - 4].m_Hash, pos.m_Hash); // The repetition is still there to be seen
+
+    while (!played.empty()) {
+        pos.UndoMove(played.back());
+        played.pop_back();
+    }
+    CHECK(Same(before, Capture(pos)));
+}
+
+// Knights shuffled back and forth, enough plies to make a history grow a few times
+static void Shuffle(Position& pos, int plies) {
+    const char* const cycle[] = { "g1f3", "g8f6", "f3g1", "f6g8" };
+    for (int i = 0; i < plies; i++) pos.MovePiece(Find(pos, cycle[i % 4]));
+}
+
+// A copy takes the history with it, and from then on either one can move and grow without the other noticing
+static void CopiedPosition() {
+    Position pos;
+    pos.SetPosition("rn2k1nr/8/8/3pP3/8/8/8/RN2K1NR w KQkq d6 0 2"); // Castling rights and en passant to carry over
+    Position fresh = pos;
+    CHECK(Same(Capture(pos), Capture(fresh)));
+    Shuffle(pos, 8);
+    Snapshot before = Capture(pos);
+
+    Position copy = pos;
+    CHECK(Same(before, Capture(copy)));
+    CHECK_EQ(copy.m_States[copy.m_Ply - 4].m_Hash, copy.m_Hash); // The earlier plies came along
+    for (Move move : GenerateMoves<ALL>(copy)) {
+        copy.MovePiece(move);
+        copy.UndoMove(move);
+    }
+    Shuffle(copy, 200);
+    CHECK(Same(before, Capture(pos)));
+
+    // The original outgrows the history it had when it was copied
+    Position assigned;
+    assigned = pos;
+    Shuffle(pos, 200);
+    CHECK(Same(before, Capture(assigned)));
+    CHECK_EQ(Zobrist_Hash(copy), copy.m_Hash);
+    CHECK_EQ(copy.m_States[copy.m_Ply - 4].m_Hash, copy.m_Hash);
+
+    CHECK(sizeof(Position) < 256);
+}
+
+// Whether a legal reversible move takes us back to a position an odd number of plies ago, found by trying them all
+static bool CanRepeat(Position& pos) {
+    for (Move move : GenerateMoves<ALL>(pos)) {
+        const ColoredPieceType piece = MovePieceType(move);
+        if (CaptureType(move) != NOPIECE || Castle(move) || piece == WPAWN || piece == BPAWN) continue;
+        const int end = std::min<int>(pos.m_States[pos.m_Ply].m_HalfMoves, pos.m_Ply);
+        pos.MovePiece(move);
+        bool found = false;
+        for (int i = 4; i <= end + 1; i += 2) found |= pos.m_States[pos.m_Ply - i].m_Hash == pos.m_Hash;
+        pos.UndoMove(move);
+        if (found) return true;
+    }
+    return false;
+}
+
+// The cuckoo table sees every repetition a reversible move can reach, as long as it lies inside the tree
+static void UpcomingRepetition() {
+    Position pos;
+    pos.SetPosition(kStartPos);
+    for (const char* move : { "g1f3", "g8f6", "f3g1" }) pos.MovePiece(Find(pos, move));
+    CHECK(pos.UpcomingRepetition(4)); // f6g8 is back at the start
+    CHECK(!pos.UpcomingRepetition(3)); // The start is the root
+    pos.MovePiece(Find(pos, "e7e6"));
+    CHECK(!pos.UpcomingRepetition(5)); // A pawn move resets it all
+
+    // The rook could go back to the start, but only because white passed on the way. A null move is not a move
+    // of the game, so nothing before it counts.
+    pos.SetPosition("r3k3/8/8/8/8/8/8/4K1N1 w - - 0 1");
+    pos.MovePiece(Find(pos, "g1f3"));
+    pos.MovePiece(Find(pos, "a8a6"));
+    pos.NullMove();
+    pos.MovePiece(Find(pos, "a6a4"));
+    pos.MovePiece(Find(pos, "f3g1"));
+    CHECK(!pos.UpcomingRepetition(6));
+
+    // Queens and rooks wandering about: whatever the brute force finds the table finds too
+    pos.SetPosition("4k3/8/3q4/8/8/3R4/8/4K2R w - - 0 1");
+    uint64 seed = 12345;
+    int found = 0;
+    for (int ply = 0; ply < 200; ply++) {
+        if (CanRepeat(pos)) {
+            found++;
+            if (!pos.UpcomingRepetition(pos.m_Ply + 1)) printf("  missed at ply %d: %s\n", pos.m_Ply, pos.ToFen().c_str());
+            CHECK(pos.UpcomingRepetition(pos.m_Ply + 1));
+        }
+        std::vector<Move> moves;
+        for (Move move : GenerateMoves<ALL>(pos)) {
+            if (CaptureType(move) == NOPIECE) moves.push_back(move);
+        }
+        if (moves.empty()) break;
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        pos.MovePiece(moves[(seed >> 33) % moves.size()]);
+    }
+    CHECK(found > 0);
+}
+
+// The material key knows the piece counts and nothing else
+static void MaterialKey() {
+    Position a, b;
+    a.SetPosition("4k3/8/8/8/8/8/R7/4K2R w K - 0 1");
+    b.SetPosition("4k3/8/8/3R4/8/1R6/8/4K3 b - - 0 1");
+    CHECK_EQ(a.m_MaterialKey, b.m_MaterialKey);
+    b.SetPosition("4k3/8/8/3r4/8/1R6/8/4K3 b - - 0 1");
+    CHECK(a.m_MaterialKey != b.m_MaterialKey);
+    b.SetPosition("4k3/8/8/8/8/1R6/8/4K3 b - - 0 1");
+    CHECK(a.m_MaterialKey != b.m_MaterialKey);
+}
+
 int main() {
     const char* const fens[] = { kStartPos, kKiwipete, kEndgame, kPromo, kMidgame, kComplex };
     const char* const names[] = { "startpos", "kiwipete", "endgame", "promo", "midgame", "complex" };
@@ -86,5 +228,15 @@ int main() {
     printf("-- null move roundtrip\n");
     for (size_t i = 0; i < 6; i++) NullRoundTrip(fens[i], names[i]);
 
+    printf("-- history grows with the game and copies can get their own\n");
+    LongGame();
+    CopiedPosition();
+
+    printf("-- upcoming repetitions\n");
+    UpcomingRepetition();
+
+    printf("-- material key\n");
+    MaterialKey();
+
     return TestSummary("test_zobrist");
 }